@@ -0,0 +1,263 @@
+
+/*
+ * Trace-driven decision latency benchmark: pushes a recorded sensor trace (see src/Trace.hpp, main --record) through the
+ * full decision path of the learner, one decision per episode:
+ *    reaction : the IMU sample that triggers the impact detector + state classification + action selection
+ *    watch    : state classification + fall detection over the frames after the action
+ *    update   : the 'q-value' update with the recorded outcome
+ *    persist  : saving the 'q-table' & 'policy' (every --persist-every decisions)
+ *    total    : all of the above for one decision
+ * and prints the per-decision latency distribution of every stage; jitter is max - p50.
+ *
+ * Built like main with bench/latency.cpp in place of main.cpp, see README.
+*/
+
+#include "../src/QLearner.hpp"
+#include "../src/Trace.hpp"
+#include "../src/PerfCounters.hpp"
+#include "../src/AsyncWriter.hpp"
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+
+typedef std::chrono::steady_clock Clock;
+
+static double since(Clock::time_point start)
+{
+   return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+   if(sorted.empty())
+      return 0.0;
+   size_t pos = (size_t) ceil(p * sorted.size());
+   return sorted[pos > 0 ? pos - 1 : 0];
+}
+
+static void report(const char* name, std::vector<double>& samples)
+{
+   std::sort(samples.begin(), samples.end());
+   double p50 = percentile(samples, 0.5);
+   double max = samples.empty() ? 0.0 : samples.back();
+   REPORT("  %-9s %10zu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, samples.size(), p50, percentile(samples, 0.99),
+          percentile(samples, 0.999), max, max - p50);
+}
+
+static void usage(const char* name)
+{
+   ERROR("Usage: %s --trace <path> [options]\n"
+         "  --qtable <path>            start from this q-table (default: empty)\n"
+         "  --policy <path>            start from this policy (default: empty)\n"
+         "  --justpolicy               select actions with justPolicy(..) instead of getAction(..)\n"
+         "  --persist-every <n>        save the tables every n decisions, 0 = never (default 1)\n"
+         "  --save-to <prefix>         where to save them (default /tmp/latency_, i.e. /tmp/latency_qtable.uy)\n"
+         "  --async-save               only snapshot & queue the tables, an AsyncWriter thread writes them (io_uring/pwrite)\n"
+         "  --repeat <n>               run the trace n times (default 1)\n"
+         "  --perf                     also count cycles/instructions/cache & branch misses of the hot learner calls\n"
+         "Hyperparameters (default: the LearnerParams defaults main trains with, names as in a sweep spec):\n"
+         "  --epsilon <p>              exploration probability\n"
+         "  --alpha <a>                learning rate\n"
+         "  --gamma <g>                discount factor\n"
+         "  --tsprate <r>              tsp rate\n"
+         "  --fallthreshold <n>        fall threshold\n", name);
+}
+
+int main(int argc, char** argv)
+{
+   std::string tracePath, qtablePath, policyPath;
+   std::string savePrefix = "/tmp/latency_";
+   bool justpolicy = false;
+   bool asyncsave = false;
+   unsigned long persistEvery = 1;
+   unsigned long repeat = 1;
+   bool perf = false;
+   LearnerParams params;
+   for(int i = 1; i < argc; i++)
+   {
+      bool hasvalue = (i + 1 < argc);
+      if(!strcmp(argv[i], "--trace") && hasvalue)
+         tracePath = argv[++i];
+      else if(!strcmp(argv[i], "--qtable") && hasvalue)
+         qtablePath = argv[++i];
+      else if(!strcmp(argv[i], "--policy") && hasvalue)
+         policyPath = argv[++i];
+      else if(!strcmp(argv[i], "--justpolicy"))
+         justpolicy = true;
+      else if(!strcmp(argv[i], "--persist-every") && hasvalue)
+         persistEvery = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--save-to") && hasvalue)
+         savePrefix = argv[++i];
+      else if(!strcmp(argv[i], "--async-save"))
+         asyncsave = true;
+      else if(!strcmp(argv[i], "--repeat") && hasvalue)
+         repeat = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--perf"))
+         perf = true;
+      else if(!strcmp(argv[i], "--epsilon") && hasvalue)
+         params.epsilon = strtof(argv[++i], NULL);
+      else if(!strcmp(argv[i], "--alpha") && hasvalue)
+         params.alpha = strtof(argv[++i], NULL);
+      else if(!strcmp(argv[i], "--gamma") && hasvalue)
+         params.gamma = strtof(argv[++i], NULL);
+      else if(!strcmp(argv[i], "--tsprate") && hasvalue)
+         params.tsprate = strtof(argv[++i], NULL);
+      else if(!strcmp(argv[i], "--fallthreshold") && hasvalue)
+         params.fallthreshold = strtoul(argv[++i], NULL, 10);
+      else
+      {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+   if(tracePath.empty())
+   {
+      usage(argv[0]);
+      return 1;
+   }
+
+   TraceReader trace;
+   if(!trace.open(tracePath))
+   {
+      ERROR("Error in loading the trace file %s\n", tracePath.c_str());
+      return 1;
+   }
+   setLogging(false);
+   setPerfCounting(perf);
+   QLearner agent;
+   agent.init(params, 9.04);
+   if(!qtablePath.empty() && !agent.loadQTable(qtablePath))
+      ERROR("Error in loading %s, starting with an empty 'q-table'\n", qtablePath.c_str());
+   if(!policyPath.empty() && !agent.loadPolicy(policyPath))
+      ERROR("Error in loading %s, starting with an empty 'policy'\n", policyPath.c_str());
+   agent.seed(0); /* same exploration on every run */
+   std::unique_ptr<AsyncWriter> writer(asyncsave ? new AsyncWriter() : NULL);
+
+   const unsigned int watchWindow = 100;
+   std::vector<double> reaction, watch, update, persist, total;
+   unsigned long decisions = 0, missed = 0;
+   Clock::time_point benchstart = Clock::now();
+   for(unsigned long r = 0; r < repeat; r++)
+   {
+      agent.resetEpisode();
+      bool acted = false;
+      bool detecting = false; /* the reaction window is open: the impact was detected, no action yet */
+      Clock::time_point reactstart;
+      double watchtime = 0.0;
+      State state, nstate;
+      Action action;
+      double feetdata[8];
+      ImuSample sample;
+      for(size_t pos = 0; pos < trace.size(); pos++)
+      {
+         const TraceRecord& record = trace[pos];
+         switch(record.type)
+         {
+            case TRACE_IMU:
+            {
+               if(acted || detecting)
+                  break;
+               TraceReader::getImuSample(record, sample);
+               Clock::time_point start = Clock::now();
+               if(agent.detectPerturbation(sample))
+               {
+                  reactstart = start;
+                  detecting = true;
+               }
+               break;
+            }
+            case TRACE_FEET:
+            {
+               TraceReader::getSensorValues(record, feetdata);
+               if(!acted)
+               {
+                  if(!detecting)
+                     break;
+                  state.feet_state = agent.determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
+                                                          feetdata[4], feetdata[5], feetdata[6], feetdata[7]);
+                  action = justpolicy ? agent.justPolicy(state) : agent.getAction(state);
+                  while(!action.isValid())
+                     action = agent.getAction(state);
+                  agent.watchFall(watchWindow);
+                  reaction.push_back(since(reactstart));
+                  acted = true;
+                  detecting = false;
+                  watchtime = 0.0;
+                  break;
+               }
+               Clock::time_point start = Clock::now();
+               nstate.feet_state = agent.determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
+                                                        feetdata[4], feetdata[5], feetdata[6], feetdata[7]);
+               if(!agent.isFallDecided())
+                  agent.detectFall(nstate.feet_state);
+               watchtime += since(start);
+               break;
+            }
+            case TRACE_OUTCOME:
+            {
+               if(!acted)
+               {
+                  missed++;
+                  agent.resetEpisode();
+                  detecting = false;
+                  break;
+               }
+               Clock::time_point start = Clock::now();
+               agent.update(state, action, nstate, record.reward);
+               double updatetime = since(start);
+               double persisttime = 0.0;
+               decisions++;
+               if(persistEvery > 0 && decisions % persistEvery == 0)
+               {
+                  start = Clock::now();
+                  if(writer)
+                  {
+                     QStore snapshot = agent.snapshot();
+                     writer->write(savePrefix + "qtable.uy", [snapshot](std::string& out) { QLearner::formatQTable(snapshot, out); });
+                     writer->write(savePrefix + "policy.uy", [snapshot](std::string& out) { QLearner::formatPolicy(snapshot, out); });
+                  }
+                  else if(!agent.saveQTable(savePrefix + "qtable.uy") || !agent.savePolicy(savePrefix + "policy.uy"))
+                  {
+                     ERROR("Error in saving the tables to %s*\n", savePrefix.c_str());
+                     return 1;
+                  }
+                  persisttime = since(start);
+                  persist.push_back(persisttime);
+               }
+               watch.push_back(watchtime);
+               update.push_back(updatetime);
+               total.push_back(reaction.back() + watchtime + updatetime + persisttime);
+               agent.resetEpisode();
+               acted = false;
+               break;
+            }
+            default:
+               break;
+         }
+      }
+   }
+   if(writer && !writer->flush())
+   {
+      ERROR("Error in saving the tables to %s*\n", savePrefix.c_str());
+      return 1;
+   }
+   double elapsed = since(benchstart) / 1e6;
+
+   REPORT("Trace '%s': %zu records x %lu, %lu decisions (%lu perturbations not detected on replay) in %.2fs\n",
+          tracePath.c_str(), trace.size(), repeat, decisions, missed, elapsed);
+   REPORT("Per-decision latency [us], q-table: %zu entries, action selection: %s\n", agent.getQTableSize(),
+          justpolicy ? "justPolicy" : "getAction");
+   REPORT("  %-9s %10s %10s %10s %10s %10s %10s\n", "stage", "n", "p50", "p99", "p99.9", "max", "jitter");
+   report("reaction", reaction);
+   report("watch", watch);
+   report("update", update);
+   report("persist", persist);
+   if(writer)
+      REPORT("  (persist: snapshot & queue only, %s wrote %lu files in the background, skipped %lu stale ones)\n",
+             writer->getBackend(), writer->getWritten(), writer->getSkipped());
+   report("total", total);
+   if(perf)
+      printPerfReport();
+   return 0;
+}
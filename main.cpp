@@ -1,14 +1,354 @@
-#include "src/QLearningSimulate.hpp" 
+
+#include "src/QLearningSimulate.hpp"
+#include "src/PerfCounters.hpp"
+#include "src/SweepRunner.hpp"
+#include "src/PolicyEvaluator.hpp"
+#include "src/QTableMerger.hpp"
+#include "src/Aggregation.hpp"
+#include "src/SharedQTable.hpp"
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+
+static AggregationServer* aggregation = NULL;
+
+static void stopAggregation(int)
+{
+   if(aggregation)
+      aggregation->stop();
+}
+
+/*
+ * The parameter averaging service for the learners started with --aggregate, until SIGINT/SIGTERM.
+*/
+static int serveAggregation(const std::string& path, unsigned int learners)
+{
+   AggregationServer server;
+   server.setLearners(learners);
+   if(!server.open(path))
+   {
+      ERROR("Error in listening on %s\n", path.c_str());
+      return 1;
+   }
+   aggregation = &server;
+   signal(SIGINT, stopAggregation);
+   signal(SIGTERM, stopAggregation);
+   REPORT("Aggregating q-tables on %s over %u learner(s), stop with Ctrl-C\n", path.c_str(), learners);
+   server.run();
+   aggregation = NULL;
+   REPORT("Aggregation summary\n");
+   REPORT("  merged      : %zu entries\n", server.size());
+   REPORT("  syncs       : %lu, %lu deltas received (%lu bytes), %lu merged values sent (%lu bytes)\n", server.getSyncs(),
+          server.getReceived(), (unsigned long) server.getBytesIn(), server.getSent(), (unsigned long) server.getBytesOut());
+   return 0;
+}
+
+/*
+ * 'robots' independent simulated robots (own learner, in memory) as coroutines on an EpisodeScheduler, each running
+ * 'episodes' episodes.
+*/
+static int runRobots(unsigned long robots, unsigned long episodes, unsigned int threads, bool realtime, unsigned int maxsteps)
+{
+   EpisodeScheduler scheduler(threads);
+   scheduler.setRealTime(realtime);
+   std::vector<std::unique_ptr<QLearningSimulate>> simulations;
+   std::vector<EpisodeTask> tasks;
+   simulations.reserve(robots);
+   tasks.reserve(robots);
+   uint64_t seed = time(NULL);
+   for(unsigned long r = 0; r < robots; r++)
+   {
+      simulations.push_back(std::unique_ptr<QLearningSimulate>(new QLearningSimulate()));
+      simulations[r]->seed(seed * 0x9e3779b97f4a7c15ULL + r + 1);
+      tasks.push_back(simulations[r]->runEpisodes(scheduler, episodes, maxsteps));
+      scheduler.spawn(tasks[r]);
+   }
+   typedef std::chrono::steady_clock Clock;
+   Clock::time_point start = Clock::now();
+   scheduler.run();
+   double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+   unsigned long total = 0, survived = 0, fell = 0;
+   for(unsigned long r = 0; r < robots; r++)
+   {
+      const TrainStats& stats = simulations[r]->getTrainStats();
+      total += stats.episodes;
+      survived += stats.survived;
+      fell += stats.fell;
+   }
+   REPORT("Robots summary\n");
+   REPORT("  robots      : %lu on %u thread(s), %lu steals\n", robots, scheduler.getThreads(), (unsigned long) scheduler.getSteals());
+   REPORT("  episodes    : %lu in %.2fs (%.0f episodes/s, %.0f events/s)\n", total, seconds, seconds > 0.0 ? total / seconds : 0.0,
+          seconds > 0.0 ? scheduler.getResumes() / seconds : 0.0);
+   REPORT("  outcomes    : %lu survived, %lu fell, %lu without perturbation\n", survived, fell, total - survived - fell);
+   return 0;
+}
+
+static void usage(const char* name)
+{
+   ERROR("Usage: %s [options]\n"
+         "  --qtable <path>            q-table file (default persistent_storage/qtable.uy)\n"
+         "  --policy <path>            policy file (default persistent_storage/policy.uy)\n"
+         "  --plan <k>                 k Dyna-Q planning updates per real step\n"
+         "  --capacity <n>             keep at most n entries in the q-table\n"
+         "  --realtime                 pace the simulation in real time instead of virtual time\n"
+         "  --max-steps <n>            time steps per episode to wait for the perturbation (default 5)\n"
+         "  --record <path>            record a binary sensor/action trace of the episodes\n"
+         "  --replay <path>            learn from a recorded trace instead of simulating\n"
+         "Headless training (runs a single verbose episode without --episodes/--seconds):\n"
+         "  --episodes <n>             stop after n episodes\n"
+         "  --seconds <t>              stop after t seconds of wall-clock time\n"
+         "  --checkpoint-every <n>     save every n episodes (default: only at the end)\n"
+         "  --async-save               write the checkpoints on a background thread (io_uring if available, else pwrite)\n"
+         "  --slots <path>             keep the q-table in a fixed-width slot file, saves only write the changed entries\n"
+         "  --sorted <path>            keep the q-table in a sorted file, loaded lazily state by state\n"
+         "  --shared <name>            learn on a q-table in shared memory together with the other processes using <name>\n"
+         "  --shared-capacity <n>      entries per state if this process creates the shared q-table (default 65536)\n"
+         "  --shared-remove <name>     remove a shared q-table left behind by crashed processes, then exit\n"
+         "  --aggregate <socket>       average the q-table with the other learners of an aggregation service\n"
+         "  --sync-every <n>           episodes between two syncs with the aggregation service (default 100)\n"
+         "  --report-every <t>         print the throughput every t seconds (default 5)\n"
+         "  --verbose                  keep the per-episode log while training\n"
+         "  --perf                     count cycles/instructions/cache & branch misses of the hot learner calls\n"
+         "Hyperparameter sweep (in memory, nothing is loaded or saved):\n"
+         "  --sweep <spec>             run the configurations of a sweep spec (see src/SweepRunner.hpp) in parallel\n"
+         "  --sweep-out <path>         CSV with the results (default sweep.csv)\n"
+         "Policy evaluation (loads the policy read-only, the q-table is neither loaded nor saved):\n"
+         "  --evaluate <n>             run n episodes with the stored policy and report the survival rate\n"
+         "  --threads <n>              worker threads for --evaluate (default: one per core) & --robots (default: 1)\n"
+         "Merging the q-tables of several runs (sorted files, see --sorted):\n"
+         "  --merge <path>             add a sorted q-table to merge (repeat for each input)\n"
+         "  --merge-out <path>         merged sorted q-table (default merged.qso), its policy goes to --policy\n"
+         "  --merge-rule <rule>        q-value of a pair found in several inputs: max (default), average (visit weighted)\n"
+         "                             or latest (most recently modified input)\n"
+         "Aggregation service (for the learners started with --aggregate):\n"
+         "  --serve-aggregation <socket> merge the q-value deltas of the learners, until Ctrl-C\n"
+         "  --learners <n>             # of learners a delta is averaged over (default 1: every delta counts in full)\n"
+         "Many robots (in memory, nothing is loaded or saved):\n"
+         "  --robots <n>               interleave n simulated robots as coroutines, --episodes each (default 100)\n", name);
+}
 
 int main(int argc, char** argv)
 {
 
    std::string qtablePath = "persistent_storage/qtable.uy";
    std::string policyPath = "persistent_storage/policy.uy";
+   unsigned int planningSteps = 0;
+   size_t capacity = 0;
+   bool training = false;
+   bool verbose = false;
+   bool realtime = false;
+   bool perf = false;
+   bool asyncsave = false;
+   std::string recordPath, replayPath;
+   std::string slotPath;
+   std::string sortedPath;
+   std::string sharedName, sharedRemove;
+   uint32_t sharedCapacity = 65536;
+   std::string aggregatePath, servePath;
+   unsigned int learners = 1;
+   std::string sweepPath, sweepOut = "sweep.csv";
+   std::vector<std::string> mergePaths;
+   std::string mergeOut = "merged.qso";
+   MergeRule mergeRule = MERGE_MAX;
+   unsigned long evaluateEpisodes = 0;
+   unsigned long robots = 0;
+   unsigned int threads = 0;
+   TrainOptions options;
+   for(int i = 1; i < argc; i++)
+   {
+      bool hasvalue = (i + 1 < argc);
+      if(!strcmp(argv[i], "--qtable") && hasvalue)
+         qtablePath = argv[++i];
+      else if(!strcmp(argv[i], "--policy") && hasvalue)
+         policyPath = argv[++i];
+      else if(!strcmp(argv[i], "--plan") && hasvalue)
+         planningSteps = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--capacity") && hasvalue)
+         capacity = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--episodes") && hasvalue)
+      {
+         options.episodes = strtoul(argv[++i], NULL, 10);
+         training = true;
+      }
+      else if(!strcmp(argv[i], "--seconds") && hasvalue)
+      {
+         options.seconds = atof(argv[++i]);
+         training = true;
+      }
+      else if(!strcmp(argv[i], "--checkpoint-every") && hasvalue)
+         options.checkpointEvery = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--max-steps") && hasvalue)
+         options.maxSteps = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--report-every") && hasvalue)
+         options.reportEvery = atof(argv[++i]);
+      else if(!strcmp(argv[i], "--slots") && hasvalue)
+         slotPath = argv[++i];
+      else if(!strcmp(argv[i], "--sorted") && hasvalue)
+         sortedPath = argv[++i];
+      else if(!strcmp(argv[i], "--shared") && hasvalue)
+         sharedName = argv[++i];
+      else if(!strcmp(argv[i], "--shared-capacity") && hasvalue)
+         sharedCapacity = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--shared-remove") && hasvalue)
+         sharedRemove = argv[++i];
+      else if(!strcmp(argv[i], "--aggregate") && hasvalue)
+         aggregatePath = argv[++i];
+      else if(!strcmp(argv[i], "--sync-every") && hasvalue)
+         options.syncEvery = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--serve-aggregation") && hasvalue)
+         servePath = argv[++i];
+      else if(!strcmp(argv[i], "--learners") && hasvalue)
+         learners = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--record") && hasvalue)
+         recordPath = argv[++i];
+      else if(!strcmp(argv[i], "--replay") && hasvalue)
+         replayPath = argv[++i];
+      else if(!strcmp(argv[i], "--sweep") && hasvalue)
+         sweepPath = argv[++i];
+      else if(!strcmp(argv[i], "--sweep-out") && hasvalue)
+         sweepOut = argv[++i];
+      else if(!strcmp(argv[i], "--merge") && hasvalue)
+         mergePaths.push_back(argv[++i]);
+      else if(!strcmp(argv[i], "--merge-out") && hasvalue)
+         mergeOut = argv[++i];
+      else if(!strcmp(argv[i], "--merge-rule") && hasvalue && QTableMerger::parseRule(argv[i + 1], mergeRule))
+         i++;
+      else if(!strcmp(argv[i], "--evaluate") && hasvalue)
+         evaluateEpisodes = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--threads") && hasvalue)
+         threads = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--robots") && hasvalue)
+         robots = strtoul(argv[++i], NULL, 10);
+      else if(!strcmp(argv[i], "--realtime"))
+         realtime = true;
+      else if(!strcmp(argv[i], "--verbose"))
+         verbose = true;
+      else if(!strcmp(argv[i], "--perf"))
+         perf = true;
+      else if(!strcmp(argv[i], "--async-save"))
+         asyncsave = true;
+      else
+      {
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   setPerfCounting(perf);
+   if(!sweepPath.empty())
+   {
+      SweepSpec spec;
+      if(!spec.load(sweepPath))
+      {
+         ERROR("Error in loading the sweep spec %s\n", sweepPath.c_str());
+         return 1;
+      }
+      setLogging(verbose);
+      SweepRunner sweep(spec);
+      std::vector<SweepResult> results = sweep.run();
+      if(!SweepRunner::writeCSV(sweepOut, results))
+      {
+         ERROR("Error in saving the sweep results to %s\n", sweepOut.c_str());
+         return 1;
+      }
+      REPORT("Sweep results: %s\n", sweepOut.c_str());
+      if(perf)
+         printPerfReport();
+      return 0;
+   }
+   if(!servePath.empty())
+      return serveAggregation(servePath, learners);
+   if(!sharedRemove.empty())
+   {
+      if(!SharedQTable::remove(sharedRemove))
+      {
+         ERROR("Error in removing the shared q-table %s: %s\n", sharedRemove.c_str(), strerror(errno));
+         return 1;
+      }
+      REPORT("Removed the shared q-table %s\n", sharedRemove.c_str());
+      return 0;
+   }
+   if(!mergePaths.empty())
+   {
+      QTableMerger merger(mergeRule);
+      for(size_t m = 0; m < mergePaths.size(); m++)
+      {
+         if(!merger.addInput(mergePaths[m]))
+         {
+            ERROR("Error in opening the sorted q-table %s\n", mergePaths[m].c_str());
+            return 1;
+         }
+      }
+      if(!merger.merge(mergeOut, policyPath))
+      {
+         ERROR("Error in saving files %s ('q-table')/%s ('policy')\n", mergeOut.c_str(), policyPath.c_str());
+         return 1;
+      }
+      REPORT("Merged %zu q-tables into %s (policy %s):\n", merger.getInputs(), mergeOut.c_str(), policyPath.c_str());
+      REPORT("  entries     : %lu from %lu records, %lu pairs in more than one input\n", merger.getEntries(),
+             merger.getRecords(), merger.getConflicts());
+      return 0;
+   }
+   if(robots > 0)
+   {
+      setLogging(verbose);
+      int result = runRobots(robots, options.episodes ? options.episodes : 100, std::max(1u, threads), realtime, options.maxSteps);
+      if(perf)
+         printPerfReport();
+      return result;
+   }
+   if(evaluateEpisodes > 0)
+   {
+      setLogging(verbose);
+      PolicyEvaluator evaluator(policyPath, threads, options.maxSteps);
+      EvaluationResult evaluation;
+      if(!evaluator.evaluate(evaluateEpisodes, evaluation))
+      {
+         ERROR("Error in loading the policy %s\n", policyPath.c_str());
+         return 1;
+      }
+      REPORT("Evaluation of %s:\n", policyPath.c_str());
+      REPORT("  episodes    : %lu (%lu survived, %lu fell, %lu without perturbation)\n", evaluation.episodes,
+             evaluation.survived, evaluation.fell, evaluation.undetected);
+      REPORT("  survival    : %.4f (95%% CI %.4f - %.4f)\n", evaluation.getSurvivalRate(), evaluation.low, evaluation.high);
+      REPORT("  throughput  : %.0f episodes/s (%.2f s)\n",
+             evaluation.seconds > 0.0 ? evaluation.episodes / evaluation.seconds : 0.0, evaluation.seconds);
+      if(perf)
+         printPerfReport();
+      return 0;
+   }
    QLearningSimulate simulate(qtablePath, policyPath);
-   
-   simulate.run();
+   if(capacity > 0)
+      simulate.setCapacity(capacity);
+   if(planningSteps > 0)
+      simulate.enablePlanning(planningSteps);
+   simulate.setRealTime(realtime);
+   if(asyncsave)
+      simulate.setAsyncPersistence(true);
+   if(!slotPath.empty())
+      simulate.setSlotFile(slotPath);
+   if(!sortedPath.empty())
+      simulate.setSortedFile(sortedPath);
+   if(!sharedName.empty())
+      simulate.setSharedTable(sharedName, sharedCapacity);
+   if(!aggregatePath.empty())
+      simulate.setAggregator(aggregatePath);
+   if(!recordPath.empty() && !simulate.recordTrace(recordPath))
+      return 1;
 
-   return 0;
-}
+   int result;
+   if(!replayPath.empty())
+      result = simulate.replay(replayPath);
+   else if(training)
+   {
+      setLogging(verbose);
+      result = simulate.train(options);
+   }
+   else
+      result = simulate.run();
+   if(perf)
+      printPerfReport();
 
+   return result > 0 ? 0 : 1;
+}
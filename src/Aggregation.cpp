@@ -0,0 +1,506 @@
+#include "Aggregation.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+static const char AGGREGATION_MAGIC[4] = {'Q', 'L', 'A', 'G'};
+
+enum MessageType{ MESSAGE_DELTAS = 1, MESSAGE_MERGED = 2 };
+
+struct MessageHeader
+{
+   char magic[4];
+   uint32_t type;
+   uint32_t count; /* entries */
+   uint32_t bytes; /* of the payload */
+};
+
+static const uint32_t MAX_PAYLOAD = 1u << 30;
+
+static void putVarint(std::string& out, uint64_t value)
+{
+   while(value >= 0x80)
+   {
+      out.push_back((char) (value | 0x80));
+      value >>= 7;
+   }
+   out.push_back((char) value);
+}
+
+static bool getVarint(const std::string& in, size_t& at, uint64_t& value)
+{
+   value = 0;
+   for(int shift = 0; shift < 64 && at < in.size(); shift += 7)
+   {
+      uint8_t byte = in[at++];
+      value |= (uint64_t) (byte & 0x7f) << shift;
+      if(!(byte & 0x80))
+         return true;
+   }
+   return false;
+}
+
+/*
+ * Payload: per state with entries, [state byte][varint # of entries] then for each entry [varint action - previous action]
+ * [float value]. Sorts 'entries'.
+*/
+static void encode(std::vector<QDelta>& entries, std::string& out)
+{
+   std::sort(entries.begin(), entries.end(),
+             [](const QDelta& a, const QDelta& b) { return a.state != b.state ? a.state < b.state : a.action < b.action; });
+   out.clear();
+   for(size_t i = 0; i < entries.size(); )
+   {
+      size_t end = i;
+      while(end < entries.size() && entries[end].state == entries[i].state)
+         end++;
+      out.push_back((char) entries[i].state);
+      putVarint(out, end - i);
+      uint64_t previous = 0;
+      for(; i < end; i++)
+      {
+         putVarint(out, entries[i].action - previous);
+         previous = entries[i].action;
+         out.append((const char*) &entries[i].value, sizeof(float));
+      }
+   }
+}
+
+static bool decode(const std::string& in, uint32_t count, std::vector<QDelta>& entries)
+{
+   entries.clear();
+   size_t at = 0;
+   while(at < in.size())
+   {
+      uint8_t state = in[at++];
+      uint64_t n, gap, action = 0;
+      if(state >= 16 || !getVarint(in, at, n) || n > count - entries.size())
+         return false;
+      for(uint64_t i = 0; i < n; i++)
+      {
+         if(!getVarint(in, at, gap) || at + sizeof(float) > in.size())
+            return false;
+         action += gap;
+         QDelta entry;
+         entry.state = state;
+         entry.action = action;
+         memcpy(&entry.value, in.data() + at, sizeof(float));
+         at += sizeof(float);
+         entries.push_back(entry);
+      }
+   }
+   return entries.size() == count;
+}
+
+static bool writeAll(int fd, const char* data, size_t size)
+{
+   while(size > 0)
+   {
+      ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+      if(written < 0 && errno == EINTR)
+         continue;
+      if(written <= 0)
+         return false;
+      data += written;
+      size -= written;
+   }
+   return true;
+}
+
+static bool readAll(int fd, char* data, size_t size)
+{
+   while(size > 0)
+   {
+      ssize_t got = recv(fd, data, size, 0);
+      if(got < 0 && errno == EINTR)
+         continue;
+      if(got <= 0)
+         return false;
+      data += got;
+      size -= got;
+   }
+   return true;
+}
+
+/*
+ * One batch, header & payload; the number of bytes that went over the socket is added to 'bytes'.
+*/
+static bool sendMessage(int fd, uint32_t type, std::vector<QDelta>& entries, std::string& payload, uint64_t& bytes)
+{
+   encode(entries, payload);
+   MessageHeader header;
+   memcpy(header.magic, AGGREGATION_MAGIC, sizeof(header.magic));
+   header.type = type;
+   header.count = entries.size();
+   header.bytes = payload.size();
+   bytes += sizeof(header) + payload.size();
+   return writeAll(fd, (const char*) &header, sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+}
+
+static bool receiveMessage(int fd, uint32_t type, std::vector<QDelta>& entries, std::string& payload, uint64_t& bytes)
+{
+   MessageHeader header;
+   if(!readAll(fd, (char*) &header, sizeof(header)) || memcmp(header.magic, AGGREGATION_MAGIC, sizeof(header.magic)) != 0 ||
+      header.type != type || header.bytes > MAX_PAYLOAD)
+      return false;
+   payload.resize(header.bytes);
+   bytes += sizeof(header) + header.bytes;
+   return readAll(fd, &payload[0], header.bytes) && decode(payload, header.count, entries);
+}
+
+static bool getAddress(const std::string& path, struct sockaddr_un& address)
+{
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if(path.size() >= sizeof(address.sun_path))
+   {
+      errno = ENAMETOOLONG;
+      return false;
+   }
+   memcpy(address.sun_path, path.c_str(), path.size());
+   return true;
+}
+
+AggregationServer::AggregationServer(): listenfd(-1), logoffset(0), version(0), weight(1.0f), stopping(false), syncs(0),
+                                        received(0), sent(0), bytesin(0), bytesout(0) {}
+
+AggregationServer::~AggregationServer()
+{
+   close();
+}
+
+/*
+ * Listens on the Unix domain socket 'path' (replacing a stale socket file).
+*/
+bool AggregationServer::open(const std::string& path)
+{
+   close();
+   struct sockaddr_un address;
+   if(!getAddress(path, address))
+      return false;
+   listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(listenfd < 0)
+      return false;
+   unlink(path.c_str());
+   if(bind(listenfd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listenfd, 64) != 0)
+   {
+      ::close(listenfd);
+      listenfd = -1;
+      return false;
+   }
+   this->path = path;
+   return true;
+}
+
+/*
+ * # of learners a delta is averaged over (default 1, i.e. every delta counts in full), whoever is connected at the time.
+*/
+void AggregationServer::setLearners(unsigned int learners)
+{
+   weight = 1.0f / std::max(1u, learners);
+}
+
+/*
+ * Serves the learners until stop() (which may be called from a signal handler or another thread).
+*/
+void AggregationServer::run()
+{
+   std::vector<struct pollfd> fds;
+   while(!stopping.load() && listenfd >= 0)
+   {
+      fds.clear();
+      fds.push_back(pollfd{listenfd, POLLIN, 0});
+      for(size_t c = 0; c < clients.size(); c++)
+         fds.push_back(pollfd{clients[c].fd, POLLIN, 0});
+      if(poll(fds.data(), fds.size(), 100) <= 0)
+         continue;
+      /*
+       * Clients first, the new connections are not in 'fds' yet.
+      */
+      for(size_t c = clients.size(); c-- > 0; )
+      {
+         if(fds[c + 1].revents && !serve(clients[c]))
+         {
+            ::close(clients[c].fd);
+            clients.erase(clients.begin() + c);
+         }
+      }
+      if(fds[0].revents & POLLIN)
+      {
+         int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+         if(fd >= 0)
+            clients.push_back(Client{fd, SIZE_MAX});
+      }
+      trim();
+   }
+}
+
+/*
+ * One sync: merges the client's deltas and answers with what changed since its last sync.
+*/
+bool AggregationServer::serve(Client& client)
+{
+   std::vector<QDelta> entries;
+   std::string payload;
+   if(!receiveMessage(client.fd, MESSAGE_DELTAS, entries, payload, bytesin))
+      return false;
+   syncs++;
+   received += entries.size();
+   version++;
+   for(size_t i = 0; i < entries.size(); i++)
+   {
+      std::pair<std::unordered_map<uint64_t, Entry>::iterator, bool> added =
+         table[entries[i].state].emplace(entries[i].action, Entry{entries[i].value, 0});
+      Entry& entry = added.first->second;
+      if(!added.second)
+         entry.value += entries[i].value * weight;
+      entry.version = version;
+      log.push_back(Change{version, entries[i].state, entries[i].action});
+   }
+
+   entries.clear();
+   if(client.logpos == SIZE_MAX)
+   {
+      for(int s = 0; s < 16; s++)
+         for(std::unordered_map<uint64_t, Entry>::const_iterator it = table[s].begin(); it != table[s].end(); ++it)
+            entries.push_back(QDelta{(uint8_t) s, it->first, it->second.value});
+   }
+   else
+   {
+      /*
+       * Only the last change of an entry counts, the earlier ones are outdated.
+      */
+      for(size_t i = client.logpos - logoffset; i < log.size(); i++)
+      {
+         const Entry& entry = table[log[i].state].find(log[i].action)->second;
+         if(entry.version == log[i].version)
+            entries.push_back(QDelta{log[i].state, log[i].action, entry.value});
+      }
+      std::sort(entries.begin(), entries.end(),
+                [](const QDelta& a, const QDelta& b) { return a.state != b.state ? a.state < b.state : a.action < b.action; });
+      entries.erase(std::unique(entries.begin(), entries.end(),
+                                [](const QDelta& a, const QDelta& b) { return a.state == b.state && a.action == b.action; }),
+                    entries.end());
+   }
+   client.logpos = logoffset + log.size();
+   sent += entries.size();
+   return sendMessage(client.fd, MESSAGE_MERGED, entries, payload, bytesout);
+}
+
+/*
+ * Drops the changes every client has got already.
+*/
+void AggregationServer::trim()
+{
+   size_t oldest = logoffset + log.size();
+   for(size_t c = 0; c < clients.size(); c++)
+   {
+      if(clients[c].logpos != SIZE_MAX)
+         oldest = std::min(oldest, clients[c].logpos);
+   }
+   size_t done = oldest - logoffset;
+   if(done > 4096 && done >= log.size() / 2)
+   {
+      log.erase(log.begin(), log.begin() + done);
+      logoffset = oldest;
+   }
+}
+
+void AggregationServer::stop()
+{
+   stopping.store(true);
+}
+
+void AggregationServer::close()
+{
+   for(size_t c = 0; c < clients.size(); c++)
+      ::close(clients[c].fd);
+   clients.clear();
+   if(listenfd >= 0)
+   {
+      ::close(listenfd);
+      unlink(path.c_str());
+   }
+   listenfd = -1;
+}
+
+/*
+ * # of entries of the merged table.
+*/
+size_t AggregationServer::size() const
+{
+   size_t total = 0;
+   for(int s = 0; s < 16; s++)
+      total += table[s].size();
+   return total;
+}
+
+unsigned long AggregationServer::getSyncs() const
+{
+   return syncs;
+}
+
+unsigned long AggregationServer::getReceived() const
+{
+   return received;
+}
+
+unsigned long AggregationServer::getSent() const
+{
+   return sent;
+}
+
+uint64_t AggregationServer::getBytesIn() const
+{
+   return bytesin;
+}
+
+uint64_t AggregationServer::getBytesOut() const
+{
+   return bytesout;
+}
+
+AggregationClient::AggregationClient(): fd(-1), first(true), syncs(0), sent(0), received(0), bytesout(0), bytesin(0) {}
+
+AggregationClient::~AggregationClient()
+{
+   close();
+}
+
+/*
+ * Connects to the service at 'path' and starts tracking the changes of 'table'. The first sync(..) replaces 'table' with
+ * the merged values and adds the entries only 'table' has to the merged table.
+*/
+bool AggregationClient::connect(const std::string& path, QStore& table)
+{
+   close();
+   struct sockaddr_un address;
+   if(!getAddress(path, address))
+      return false;
+   fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(fd < 0)
+      return false;
+   if(::connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+   {
+      close();
+      return false;
+   }
+   table.setDirtyTracking(DIRTY_SYNC, true);
+   for(int s = 0; s < 16; s++)
+      bases[s].clear();
+   first = true;
+   return true;
+}
+
+/*
+ * Exchanges the changes with the service, false if it went away.
+*/
+bool AggregationClient::sync(QStore& table)
+{
+   if(fd < 0)
+      return false;
+   FeetState state;
+   size_t pos;
+   if(first)
+   {
+      /*
+       * Nothing sent, the whole merged table comes back and becomes the base. What the merged table does not have goes
+       * out as new entries, their value is the delta against nothing.
+      */
+      table.clearDirty(DIRTY_SYNC);
+      if(!exchange(table))
+         return false;
+      first = false;
+      for(int s = 0; s < 16; s++)
+      {
+         for(pos = 0; pos < table.getStateSize((FeetState) s); pos++)
+         {
+            uint64_t action = table.getKey((FeetState) s, pos);
+            if(bases[s].find(action) == bases[s].end())
+               deltas.push_back(QDelta{(uint8_t) s, action, (float) table.getQValue((FeetState) s, pos)});
+         }
+      }
+   }
+   else
+   {
+      for(size_t i = 0; i < table.getDirtySize(DIRTY_SYNC); i++)
+      {
+         if(!table.getDirty(DIRTY_SYNC, i, state, pos))
+            continue;
+         uint64_t action = table.getKey(state, pos);
+         std::unordered_map<uint64_t, float>::const_iterator base = bases[state].find(action);
+         float delta = table.getQValue(state, pos) - (base == bases[state].end() ? 0.0f : base->second);
+         if(delta != 0.0f || base == bases[state].end()) /* a new entry goes out even if it is still 0 */
+            deltas.push_back(QDelta{(uint8_t) state, action, delta});
+      }
+   }
+   table.clearDirty(DIRTY_SYNC);
+   if(!exchange(table))
+      return false;
+   syncs++;
+   return true;
+}
+
+/*
+ * Sends 'deltas' and takes over the merged values that come back, false (& closed) if the service went away.
+*/
+bool AggregationClient::exchange(QStore& table)
+{
+   std::string payload;
+   sent += deltas.size();
+   if(!sendMessage(fd, MESSAGE_DELTAS, deltas, payload, bytesout) || !receiveMessage(fd, MESSAGE_MERGED, deltas, payload, bytesin))
+   {
+      close();
+      return false;
+   }
+   for(size_t i = 0; i < deltas.size(); i++)
+   {
+      table.assign((FeetState) deltas[i].state, deltas[i].action, deltas[i].value);
+      bases[deltas[i].state][deltas[i].action] = QStore::round(deltas[i].value);
+   }
+   received += deltas.size();
+   deltas.clear();
+   return true;
+}
+
+void AggregationClient::close()
+{
+   if(fd >= 0)
+      ::close(fd);
+   fd = -1;
+   deltas.clear();
+}
+
+bool AggregationClient::isConnected() const
+{
+   return fd >= 0;
+}
+
+unsigned long AggregationClient::getSyncs() const
+{
+   return syncs;
+}
+
+unsigned long AggregationClient::getSent() const
+{
+   return sent;
+}
+
+unsigned long AggregationClient::getReceived() const
+{
+   return received;
+}
+
+uint64_t AggregationClient::getBytesOut() const
+{
+   return bytesout;
+}
+
+uint64_t AggregationClient::getBytesIn() const
+{
+   return bytesin;
+}
@@ -0,0 +1,141 @@
+#ifndef _AGGREGATION_
+#define _AGGREGATION_
+
+#include "QStore.hpp"
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * One 'Q' table entry on the wire: a q-value delta from a learner, a merged q-value from the service.
+*/
+struct QDelta
+{
+   uint8_t state;
+   uint64_t action;
+   float value;
+};
+
+/*
+ * Local parameter averaging service for learner processes that each train their own 'Q' table (no shared table, no
+ * common lock). Every so many episodes a learner sends, in one message over a Unix domain socket, the q-value deltas of the
+ * entries it changed since its previous sync (see AggregationClient); the service adds each delta, divided by the number
+ * of learners it averages over (setLearners(..), fixed for the whole run), to the merged table and answers with the merged
+ * values of every entry that changed since that learner's previous sync (everything on the first one), which the learner
+ * takes over. A delta for an entry the merged table does not have yet is its first value and is taken as it is.
+ * Messages are batches sorted by <state, action>, with the actions delta coded as varints (~7 bytes per entry instead of
+ * 16). Changes are kept in a log that is trimmed once every learner got them.
+*/
+class AggregationServer
+{
+   struct Entry
+   {
+      float value;
+      uint64_t version; /* of the last change */
+   };
+
+   struct Change
+   {
+      uint64_t version;
+      uint8_t state;
+      uint64_t action;
+   };
+
+   struct Client
+   {
+      int fd;
+      size_t logpos; /* absolute position in the change log, SIZE_MAX = needs the whole table */
+   };
+
+   int listenfd;
+   std::string path;
+   std::unordered_map<uint64_t, Entry> table[16];
+   std::vector<Change> log;
+   size_t logoffset; /* # of changes trimmed from the front of 'log' */
+   uint64_t version;
+   std::vector<Client> clients;
+   float weight; /* of a delta, 1 / # of learners */
+   std::atomic<bool> stopping;
+   unsigned long syncs, received, sent;
+   uint64_t bytesin, bytesout;
+
+   bool serve(Client& client);
+
+   void trim();
+
+public:
+
+   AggregationServer();
+
+   ~AggregationServer();
+
+   bool open(const std::string& path);
+
+   void setLearners(unsigned int learners);
+
+   void run();
+
+   void stop();
+
+   void close();
+
+   size_t size() const;
+
+   unsigned long getSyncs() const;
+
+   unsigned long getReceived() const;
+
+   unsigned long getSent() const;
+
+   uint64_t getBytesIn() const;
+
+   uint64_t getBytesOut() const;
+
+};
+
+/*
+ * The learner's end of an AggregationServer: sync(..) sends the deltas of the entries the 'Q' table marked dirty since the
+ * last sync (dirty tracking is turned on by connect(..)) against the values last received from the service, and takes
+ * over the merged values it gets back. The first sync after connect(..) sends nothing but fetches the merged table, takes
+ * it over as its base and only then sends the entries the service does not have yet, so that a learner that joins late
+ * (or reconnects) does not add its whole table on top of the merged one.
+*/
+class AggregationClient
+{
+   int fd;
+   std::unordered_map<uint64_t, float> bases[16]; /* last merged q-value of every entry */
+   std::vector<QDelta> deltas;
+   bool first; /* the merged table was not fetched yet */
+   unsigned long syncs, sent, received;
+   uint64_t bytesout, bytesin;
+
+   bool exchange(QStore& table);
+
+public:
+
+   AggregationClient();
+
+   ~AggregationClient();
+
+   bool connect(const std::string& path, QStore& table);
+
+   bool sync(QStore& table);
+
+   void close();
+
+   bool isConnected() const;
+
+   unsigned long getSyncs() const;
+
+   unsigned long getSent() const;
+
+   unsigned long getReceived() const;
+
+   uint64_t getBytesOut() const;
+
+   uint64_t getBytesIn() const;
+
+};
+
+#endif
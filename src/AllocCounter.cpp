@@ -0,0 +1,105 @@
+#include "AllocCounter.hpp"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+static std::atomic<uint64_t> allocations(0);
+
+static void* allocate(size_t size)
+{
+   allocations.fetch_add(1, std::memory_order_relaxed);
+   return malloc(size ? size : 1);
+}
+
+static void* allocateAligned(size_t size, std::align_val_t alignment)
+{
+   allocations.fetch_add(1, std::memory_order_relaxed);
+   size_t align = (size_t) alignment;
+   size = ((size ? size : 1) + align - 1) & ~(align - 1); /* aligned_alloc wants a multiple of the alignment */
+   return aligned_alloc(align, size);
+}
+
+void* operator new(size_t size)
+{
+   void* p = allocate(size);
+   if(!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size)
+{
+   void* p = allocate(size);
+   if(!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+   return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+   return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+   void* p = allocateAligned(size, alignment);
+   if(!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+   void* p = allocateAligned(size, alignment);
+   if(!p)
+      throw std::bad_alloc();
+   return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete[](void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+bool isCountingAllocations()
+{
+   return true;
+}
+
+uint64_t getHeapAllocations()
+{
+   return allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool isCountingAllocations()
+{
+   return false;
+}
+
+uint64_t getHeapAllocations()
+{
+   return 0;
+}
+
+#endif
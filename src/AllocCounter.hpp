@@ -0,0 +1,18 @@
+#ifndef _ALLOCCOUNTER_
+#define _ALLOCCOUNTER_
+
+#include <stdint.h>
+
+/*
+ * Global heap allocation counter, to check that the steady state of training does not touch the heap (see EpisodeArena).
+ * Only built with -DCOUNT_ALLOCATIONS, which replaces the global operator new/delete with counting malloc/free wrappers;
+ * otherwise nothing is counted and isCountingAllocations() is false.
+*/
+bool isCountingAllocations();
+
+/*
+ * # of global operator new calls (all threads) since the start of the program.
+*/
+uint64_t getHeapAllocations();
+
+#endif
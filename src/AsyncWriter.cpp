@@ -0,0 +1,174 @@
+#include "AsyncWriter.hpp"
+#include "log.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/*
+ * 4 registered buffers of 256 KiB: a q-table of ~1000 entries is ~90 KB of text, i.e. written in one go.
+*/
+static const unsigned int URING_BUFFERS = 4;
+static const size_t URING_BUFFER_SIZE = 256 * 1024;
+
+/*
+ * 'uring' = false forces the pwrite backend.
+*/
+AsyncWriter::AsyncWriter(bool uring): busy(false), stopping(false), failed(false), written(0), skipped(0)
+{
+   if(uring && !ring.init(URING_BUFFERS, URING_BUFFER_SIZE))
+      LOG("io_uring is not available (%s), writing with pwrite\n", strerror(errno));
+   worker = std::thread(&AsyncWriter::work, this);
+}
+
+/*
+ * Writes what is still queued before returning.
+*/
+AsyncWriter::~AsyncWriter()
+{
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+   }
+   wake.notify_one();
+   worker.join();
+}
+
+/*
+ * Queues writing the file 'path' with the content 'produce' will generate (on the writer thread) and returns right away.
+*/
+void AsyncWriter::write(const std::string& path, std::function<void(std::string&)> produce)
+{
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      for(size_t i = 0; i < jobs.size(); i++)
+      {
+         if(jobs[i].path == path)
+         {
+            jobs[i].produce = std::move(produce);
+            skipped++;
+            return;
+         }
+      }
+      Job job;
+      job.path = path;
+      job.produce = std::move(produce);
+      jobs.push_back(std::move(job));
+   }
+   wake.notify_one();
+}
+
+/*
+ * Waits until everything queued so far is on disk, false if any write failed since the last flush().
+*/
+bool AsyncWriter::flush()
+{
+   std::unique_lock<std::mutex> guard(lock);
+   idle.wait(guard, [this]() { return jobs.empty() && !busy; });
+   bool ok = !failed;
+   failed = false;
+   return ok;
+}
+
+const char* AsyncWriter::getBackend() const
+{
+   return ring.isReady() ? "io_uring" : "pwrite";
+}
+
+/*
+ * Files written so far.
+*/
+unsigned long AsyncWriter::getWritten()
+{
+   std::lock_guard<std::mutex> guard(lock);
+   return written;
+}
+
+/*
+ * Queued writes replaced by a newer one before they were started.
+*/
+unsigned long AsyncWriter::getSkipped()
+{
+   std::lock_guard<std::mutex> guard(lock);
+   return skipped;
+}
+
+void AsyncWriter::work()
+{
+   std::unique_lock<std::mutex> guard(lock);
+   while(true)
+   {
+      wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+      if(jobs.empty())
+         return; /* stopping */
+      Job job = std::move(jobs.front());
+      jobs.pop_front();
+      busy = true;
+      guard.unlock();
+
+      data.clear();
+      job.produce(data);
+      bool ok = writeFile(job.path, data);
+      if(!ok)
+         ERROR("Error in saving file %s: %s\n", job.path.c_str(), strerror(errno));
+      job.produce = nullptr; /* drops e.g. the snapshot while still off the lock */
+
+      guard.lock();
+      busy = false;
+      failed = failed || !ok;
+      written += ok;
+      if(jobs.empty())
+         idle.notify_all();
+   }
+}
+
+bool AsyncWriter::writeFile(const std::string& path, const std::string& data)
+{
+   std::string temp = path + ".tmp";
+   int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if(fd < 0)
+      return false;
+   bool ok;
+   if(ring.isReady())
+   {
+      ok = ring.writeFile(fd, data.data(), data.size(), true);
+      if(!ok && !ring.isReady())
+      {
+         LOG("io_uring failed (%s), writing with pwrite from now on\n", strerror(errno));
+         ok = pwriteFile(fd, data);
+      }
+   }
+   else
+      ok = pwriteFile(fd, data);
+   int error = errno;
+   ok = (close(fd) == 0) && ok;
+   if(ok && rename(temp.c_str(), path.c_str()) != 0)
+   {
+      error = errno;
+      ok = false;
+   }
+   if(!ok)
+   {
+      unlink(temp.c_str());
+      if(error)
+         errno = error;
+   }
+   return ok;
+}
+
+/*
+ * All of 'data' from offset 0 on, then fdatasync.
+*/
+bool AsyncWriter::pwriteFile(int fd, const std::string& data)
+{
+   size_t pos = 0;
+   while(pos < data.size())
+   {
+      ssize_t n = pwrite(fd, data.data() + pos, data.size() - pos, pos);
+      if(n > 0)
+         pos += n;
+      else if(n == 0 || errno != EINTR)
+         return false;
+   }
+   return fdatasync(fd) == 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _ASYNCWRITER_
+#define _ASYNCWRITER_
+
+#include "IoUring.hpp"
+#include <string>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * Writes & fdatasyncs whole files on a background thread, so that persisting costs the caller no syscalls at all: write(..)
+ * only queues a job, even the content is produced on the writer thread (e.g. formatting a QStore::snapshot()). A newer job
+ * for a file that is still queued replaces the queued one, so on a slow disk stale checkpoints are skipped instead of
+ * piling up. The files are written with io_uring through registered buffers (see IoUring) where the kernel allows it,
+ * with pwrite otherwise (also from the first failure of the ring on). A file is written to '<path>.tmp' and renamed over
+ * 'path' once synced, so a crash half way through leaves the previous file.
+*/
+class AsyncWriter
+{
+   struct Job
+   {
+      std::string path;
+      std::function<void(std::string&)> produce;
+   };
+
+   IoUring ring;
+   std::deque<Job> jobs;
+   std::mutex lock;
+   std::condition_variable wake; /* a job was queued or stop */
+   std::condition_variable idle; /* nothing queued or being written */
+   bool busy;
+   bool stopping;
+   bool failed; /* since the last flush() */
+   unsigned long written, skipped;
+   std::string data; /* content of the current job, reused */
+   std::thread worker;
+
+   void work();
+
+   bool writeFile(const std::string& path, const std::string& data);
+
+   static bool pwriteFile(int fd, const std::string& data);
+
+public:
+
+   AsyncWriter(bool uring = true);
+
+   ~AsyncWriter();
+
+   void write(const std::string& path, std::function<void(std::string&)> produce);
+
+   bool flush();
+
+   const char* getBackend() const;
+
+   unsigned long getWritten();
+
+   unsigned long getSkipped();
+
+};
+
+#endif
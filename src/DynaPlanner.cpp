@@ -0,0 +1,186 @@
+#include "DynaPlanner.hpp"
+#include <math.h>
+#include <algorithm>
+
+DynaPlanner::DynaPlanner(QLearner& agent, unsigned int steps, double theta, size_t capacity): agent(agent), steps(steps),
+                                                                                              theta(theta), capacity(capacity),
+                                                                                              budget(0), running(true)
+{
+   worker = std::thread(&DynaPlanner::plan, this);
+}
+
+DynaPlanner::~DynaPlanner()
+{
+   stop();
+}
+
+/*
+ * Called for every real step instead of QLearner::update(..): does the real update, learns the outcome and hands 'steps'
+ * planning updates to the background thread. Returns the TD error of the real step, before its update.
+*/
+double DynaPlanner::observe(State& state, Action& action, State& nextstate, int reward)
+{
+   std::lock_guard<std::mutex> guard(lock);
+   double value = agent.getValue(state);
+   double error = agent.getTDError(state, action, nextstate, reward);
+   agent.update(state, action, nextstate, reward);
+
+   uint64_t key = action.getKey();
+   Outcome outcome;
+   outcome.nextstate = nextstate.feet_state;
+   outcome.reward = reward;
+   std::unordered_map<uint64_t, Outcome>::iterator found = model[state.feet_state].find(key);
+   std::pair<uint8_t, uint64_t> pair((uint8_t) state.feet_state, key);
+   if(found == model[state.feet_state].end())
+      model[state.feet_state][key] = outcome;
+   else
+   {
+      predecessors[found->second.nextstate].erase(pair);
+      found->second = outcome;
+   }
+   predecessors[outcome.nextstate].insert(pair);
+
+   /*
+    * Q(state, action) just changed, if that changed the value of 'state' whatever leads to it has to be looked at again.
+   */
+   queue(state.feet_state, key, reward, agent.getValue(nextstate));
+   if(agent.getValue(state) != value)
+      queuePredecessors(state.feet_state);
+
+   /*
+    * No point owing more updates than there can be pairs queued, and sync() waits for all of them.
+   */
+   budget = std::min<size_t>(budget + steps, capacity);
+   wake.notify_one();
+   return error;
+}
+
+/*
+ * Blocks until the planning updates owed to the real steps are done (or nothing is left to sweep), e.g. before saving the 'Q' table.
+*/
+void DynaPlanner::sync()
+{
+   std::unique_lock<std::mutex> guard(lock);
+   idle.wait(guard, [this] { return !running || budget == 0 || sweeps.empty(); });
+}
+
+void DynaPlanner::stop()
+{
+   {
+      std::lock_guard<std::mutex> guard(lock);
+      if(!running)
+         return;
+      running = false;
+   }
+   wake.notify_one();
+   worker.join();
+   idle.notify_all();
+}
+
+std::mutex& DynaPlanner::getLock()
+{
+   return lock;
+}
+
+size_t DynaPlanner::getModelSize()
+{
+   std::lock_guard<std::mutex> guard(lock);
+   size_t size = 0;
+   for(int s = 0; s < 16; s++)
+      size += model[s].size();
+   return size;
+}
+
+/*
+ * Queue a <state, action> pair if the model says its update would change its q-value enough ('nextvalue' being the value
+ * of the next state the model predicts), or raise its priority if it is queued already. Pairs the 'Q' table no longer has
+ * (evicted) are left alone. Needs 'lock'.
+*/
+void DynaPlanner::queue(uint8_t state, uint64_t action, int reward, double nextvalue)
+{
+   State s;
+   Action a;
+   s.feet_state = (FeetState) state;
+   a.setKey(action);
+   double priority;
+   if(!agent.getTDError(s, a, nextvalue, reward, priority))
+      return;
+   priority = fabs(priority);
+   if(priority <= theta)
+      return;
+
+   Sweep sweep;
+   sweep.state = state;
+   sweep.action = action;
+   std::unordered_map<uint64_t, double>::iterator found = queued[state].find(action);
+   if(found != queued[state].end())
+   {
+      if(priority <= found->second)
+         return;
+      sweep.priority = found->second;
+      sweeps.erase(sweep);
+   }
+   else if(sweeps.size() >= capacity)
+   {
+      std::set<Sweep>::iterator lowest = std::prev(sweeps.end());
+      if(priority <= lowest->priority)
+         return;
+      queued[lowest->state].erase(lowest->action);
+      sweeps.erase(lowest);
+   }
+   sweep.priority = priority;
+   sweeps.insert(sweep);
+   queued[state][action] = priority;
+}
+
+/*
+ * Needs 'lock'.
+*/
+void DynaPlanner::queuePredecessors(uint8_t state)
+{
+   State s;
+   s.feet_state = (FeetState) state;
+   double value = agent.getValue(s);
+   std::set<std::pair<uint8_t, uint64_t> >::iterator iter;
+   for(iter = predecessors[state].begin(); iter != predecessors[state].end(); ++iter)
+      queue(iter->first, iter->second, model[iter->first][iter->second].reward, value);
+}
+
+/*
+ * Planning thread, one simulated update at a time so the owner never waits long on 'lock'.
+*/
+void DynaPlanner::plan()
+{
+   std::unique_lock<std::mutex> guard(lock);
+   while(running)
+   {
+      if(budget == 0 || sweeps.empty())
+      {
+         idle.notify_all();
+         wake.wait(guard, [this] { return !running || (budget > 0 && !sweeps.empty()); });
+         continue;
+      }
+      Sweep sweep = *sweeps.begin();
+      sweeps.erase(sweeps.begin());
+      queued[sweep.state].erase(sweep.action);
+      budget--;
+
+      Outcome outcome = model[sweep.state][sweep.action];
+      State s, ns;
+      Action a;
+      s.feet_state = (FeetState) sweep.state;
+      ns.feet_state = (FeetState) outcome.nextstate;
+      a.setKey(sweep.action);
+      double value = agent.getValue(s), error;
+      if(agent.getTDError(s, a, agent.getValue(ns), outcome.reward, error)) /* false if evicted since it was queued */
+      {
+         agent.update(s, a, ns, outcome.reward);
+         if(agent.getValue(s) != value)
+            queuePredecessors(sweep.state);
+      }
+
+      guard.unlock();
+      std::this_thread::yield();
+      guard.lock();
+   }
+}
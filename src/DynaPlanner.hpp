@@ -0,0 +1,83 @@
+#ifndef _DYNAPLANNER_
+#define _DYNAPLANNER_
+
+#include "QLearner.hpp"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <set>
+
+/*
+ * Dyna-Q: every real 'state = action => nextstate' outcome is stored in a small (deterministic) model and a background thread
+ * replays it through QLearner::update(..), 'steps' simulated updates per real step. The replayed pairs are picked by prioritized
+ * sweeping i.e. biggest |TD error| first, and whenever the value of 's' changes the pairs leading to 's' are queued again. A pair is
+ * queued at most once (with its highest priority) and at most 'capacity' pairs are queued, the lowest priorities are dropped.
+ *
+ * The planner updates the agent from its own thread, so the owner has to hold getLock() whenever it touches the agent.
+*/
+class DynaPlanner
+{
+   /*
+    * What the model predicts for a <state, action> pair.
+   */
+   struct Outcome
+   {
+      uint8_t nextstate;
+      int32_t reward;
+   };
+
+   struct Sweep
+   {
+      double priority;
+      uint8_t state;
+      uint64_t action; /* Action::getKey() */
+      bool operator<(const Sweep& other) const /* highest priority first */
+      {
+         if(priority != other.priority)
+            return priority > other.priority;
+         return state != other.state ? state < other.state : action < other.action;
+      }
+   };
+
+   QLearner& agent;
+   unsigned int steps; /* planning updates per real step */
+   double theta; /* smallest |TD error| worth queueing */
+   size_t capacity; /* most pairs queued at once */
+
+   std::unordered_map<uint64_t, Outcome> model[16];
+   std::set<std::pair<uint8_t, uint64_t> > predecessors[16]; /* <state, action> pairs the model says lead to a state */
+   std::set<Sweep> sweeps;
+   std::unordered_map<uint64_t, double> queued[16]; /* priority of every pair in 'sweeps' */
+
+   std::mutex lock;
+   std::condition_variable wake;
+   std::condition_variable idle;
+   std::thread worker;
+   unsigned int budget; /* planning updates still owed to the real steps */
+   bool running;
+
+   void queue(uint8_t state, uint64_t action, int reward, double nextvalue);
+
+   void queuePredecessors(uint8_t state);
+
+   void plan();
+
+public:
+
+   DynaPlanner(QLearner& agent, unsigned int steps, double theta = 1e-4, size_t capacity = 65536);
+
+   ~DynaPlanner();
+
+   double observe(State& state, Action& action, State& nextstate, int reward);
+
+   void sync();
+
+   void stop();
+
+   std::mutex& getLock();
+
+   size_t getModelSize();
+
+};
+
+#endif
@@ -0,0 +1,16 @@
+#include "EpisodeArena.hpp"
+
+EpisodeArena::EpisodeArena(): resource(buffer, BUFFER_BYTES, std::pmr::new_delete_resource()) {}
+
+std::pmr::memory_resource* EpisodeArena::get()
+{
+   return &resource;
+}
+
+/*
+ * Everything allocated from the arena so far is gone after this.
+*/
+void EpisodeArena::reset()
+{
+   resource.release();
+}
@@ -0,0 +1,52 @@
+#ifndef _EPISODEARENA_
+#define _EPISODEARENA_
+
+#include <stddef.h>
+#include <memory_resource>
+
+/*
+ * Monotonic arena for the short-lived temporaries of a decision (candidate action lists, batch keys, ...): allocating is a
+ * pointer bump into an inline buffer, freeing is a no-op and reset() hands the whole buffer back at once. Every call that
+ * allocates from it resets it on the way out (see Scope), so that it never grows, whoever drives the learner.
+ * Only when a call outgrows the buffer does the arena fall back to the global heap (until the next reset()).
+*/
+class EpisodeArena
+{
+   /*
+    * The keys of a full QLearner::updateBatch(..) (QLearner::MAX_BATCH x 8 bytes) & a decision's candidate actions.
+   */
+   static const size_t BUFFER_BYTES = 40 * 1024;
+
+   alignas(std::max_align_t) unsigned char buffer[BUFFER_BYTES];
+   std::pmr::monotonic_buffer_resource resource;
+
+public:
+
+   EpisodeArena();
+
+   EpisodeArena(const EpisodeArena&) = delete;
+
+   EpisodeArena& operator=(const EpisodeArena&) = delete;
+
+   std::pmr::memory_resource* get();
+
+   void reset();
+
+   /*
+    * Resets the arena when it goes out of scope: declare it before the temporaries, so that they are gone by then.
+   */
+   class Scope
+   {
+      EpisodeArena& arena;
+
+   public:
+
+      Scope(EpisodeArena& arena): arena(arena) {}
+
+      ~Scope() { arena.reset(); }
+
+   };
+
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "EpisodeScheduler.hpp"
+#include <algorithm>
+#include <thread>
+
+/*
+ * Queue of the worker running on this thread, where the robots it resumes wait for their next event.
+*/
+static thread_local size_t currentQueue = 0;
+
+EpisodeTask EpisodeTask::promise_type::get_return_object()
+{
+   return EpisodeTask(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+/*
+ * The robot is done, the worker that resumed it must not touch the frame anymore.
+*/
+void EpisodeTask::promise_type::Finished::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+   if(handle.promise().scheduler)
+      handle.promise().scheduler->finished();
+}
+
+EpisodeTask& EpisodeTask::operator=(EpisodeTask&& other) noexcept
+{
+   if(this != &other)
+   {
+      if(handle)
+         handle.destroy();
+      handle = other.handle;
+      other.handle = nullptr;
+   }
+   return *this;
+}
+
+EpisodeTask::~EpisodeTask()
+{
+   if(handle)
+      handle.destroy();
+}
+
+bool EpisodeTask::done() const
+{
+   return !handle || handle.done();
+}
+
+EpisodeScheduler::EpisodeScheduler(unsigned int threads): live(0), seq(0), pushed(0), sleeping(0), steals(0), resumes(0),
+                                                          nextQueue(0), realtime(false)
+{
+   for(unsigned int t = 0; t < std::max(1u, threads); t++)
+      queues.push_back(std::unique_ptr<Queue>(new Queue()));
+}
+
+/*
+ * Pace the robots in real time: an event at virtual time t (seconds since run()) is not resumed before t has passed.
+*/
+void EpisodeScheduler::setRealTime(bool realtime)
+{
+   this->realtime = realtime;
+}
+
+/*
+ * The robot starts at virtual time 0, once run() is called.
+*/
+void EpisodeScheduler::spawn(EpisodeTask& task)
+{
+   task.handle.promise().scheduler = this;
+   live++;
+   push(nextQueue, 0.0, task.handle);
+   nextQueue = (nextQueue + 1) % queues.size();
+}
+
+/*
+ * co_await at(time) suspends the robot until virtual time 'time'.
+*/
+EpisodeScheduler::Wait EpisodeScheduler::at(double time)
+{
+   return Wait{this, time};
+}
+
+/*
+ * Once pushed, another worker may resume (& even finish) the robot right away, so nothing of the frame, this awaiter
+ * included, is touched afterwards.
+*/
+void EpisodeScheduler::Wait::await_suspend(std::coroutine_handle<> handle)
+{
+   EpisodeScheduler* scheduler = this->scheduler;
+   scheduler->push(currentQueue, time, handle);
+}
+
+void EpisodeScheduler::push(size_t queue, double time, std::coroutine_handle<> handle)
+{
+   Entry entry;
+   entry.time = time;
+   entry.seq = seq++;
+   entry.handle = handle;
+   Queue& q = *queues[queue];
+   {
+      std::lock_guard<std::mutex> guard(q.lock);
+      q.heap.push_back(entry);
+      std::push_heap(q.heap.begin(), q.heap.end(), Later());
+   }
+   pushed++;
+   if(sleeping > 0)
+      wakeUp(false);
+}
+
+bool EpisodeScheduler::pop(size_t queue, Entry& entry)
+{
+   Queue& q = *queues[queue];
+   std::lock_guard<std::mutex> guard(q.lock);
+   if(q.heap.empty())
+      return false;
+   std::pop_heap(q.heap.begin(), q.heap.end(), Later());
+   entry = q.heap.back();
+   q.heap.pop_back();
+   return true;
+}
+
+/*
+ * Takes the earliest robot of the first other worker that has one waiting.
+*/
+bool EpisodeScheduler::steal(size_t thief, Entry& entry)
+{
+   for(size_t i = 1; i < queues.size(); i++)
+   {
+      if(pop((thief + i) % queues.size(), entry))
+      {
+         steals++;
+         return true;
+      }
+   }
+   return false;
+}
+
+void EpisodeScheduler::work(size_t queue)
+{
+   currentQueue = queue;
+   Entry entry;
+   uint64_t resumed = 0;
+   while(live > 0)
+   {
+      uint64_t seen = pushed;
+      if(!pop(queue, entry) && !steal(queue, entry))
+      {
+         /*
+          * Everything left is running on the other workers right now.
+         */
+         sleep(seen);
+         continue;
+      }
+      if(realtime)
+         std::this_thread::sleep_until(wallstart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                      std::chrono::duration<double>(entry.time)));
+      entry.handle.resume();
+      resumed++;
+   }
+   resumes += resumed;
+}
+
+/*
+ * Parks an idle worker until a robot is queued after 'seen' (the value of 'pushed' before it last looked at the queues)
+ * or all robots are done. 'sleeping' is raised before 'pushed' is checked again and push(..) bumps 'pushed' before it
+ * checks 'sleeping', so either the worker sees the new robot or push(..) sees the worker and wakes it.
+*/
+void EpisodeScheduler::sleep(uint64_t seen)
+{
+   std::unique_lock<std::mutex> guard(idlelock);
+   sleeping++;
+   wake.wait(guard, [this, seen]() { return pushed != seen || live == 0; });
+   sleeping--;
+}
+
+/*
+ * Taking 'idlelock' orders the notification after a worker that is about to wait has checked its condition.
+*/
+void EpisodeScheduler::wakeUp(bool all)
+{
+   {
+      std::lock_guard<std::mutex> guard(idlelock);
+   }
+   if(all)
+      wake.notify_all();
+   else
+      wake.notify_one();
+}
+
+/*
+ * Runs all spawned robots to completion, on the calling thread alone or on 'threads' workers.
+*/
+void EpisodeScheduler::run()
+{
+   wallstart = std::chrono::steady_clock::now();
+   if(queues.size() == 1)
+   {
+      work(0);
+      return;
+   }
+   std::vector<std::thread> pool;
+   for(size_t t = 0; t < queues.size(); t++)
+      pool.push_back(std::thread(&EpisodeScheduler::work, this, t));
+   for(size_t t = 0; t < pool.size(); t++)
+      pool[t].join();
+}
+
+void EpisodeScheduler::finished()
+{
+   if(--live == 0 && sleeping > 0)
+      wakeUp(true);
+}
+
+unsigned int EpisodeScheduler::getThreads() const
+{
+   return queues.size();
+}
+
+/*
+ * Robots a worker took from the queue of another worker.
+*/
+uint64_t EpisodeScheduler::getSteals() const
+{
+   return steals;
+}
+
+/*
+ * Total # of times a robot was resumed, i.e. of events handled.
+*/
+uint64_t EpisodeScheduler::getResumes() const
+{
+   return resumes;
+}
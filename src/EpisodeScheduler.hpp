@@ -0,0 +1,151 @@
+#ifndef _EPISODESCHEDULER_
+#define _EPISODESCHEDULER_
+
+#include <coroutine>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+class EpisodeScheduler;
+
+/*
+ * Coroutine of a simulated robot, see QLearningSimulate::runEpisodes(..). Created suspended, EpisodeScheduler::spawn(..)
+ * hands it to a scheduler; the frame lives until the task is destroyed, i.e. keep the task until the scheduler is done.
+*/
+class EpisodeTask
+{
+public:
+
+   struct promise_type
+   {
+      /*
+       * Tells the scheduler that the robot is done, the frame stays until the task is destroyed.
+      */
+      struct Finished
+      {
+         bool await_ready() noexcept { return false; }
+         void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+         void await_resume() noexcept {}
+      };
+
+      EpisodeScheduler* scheduler = nullptr;
+
+      EpisodeTask get_return_object();
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      Finished final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+   };
+
+   EpisodeTask(): handle(nullptr) {}
+   explicit EpisodeTask(std::coroutine_handle<promise_type> handle): handle(handle) {}
+   EpisodeTask(EpisodeTask&& other) noexcept: handle(other.handle) { other.handle = nullptr; }
+   EpisodeTask& operator=(EpisodeTask&& other) noexcept;
+   EpisodeTask(const EpisodeTask&) = delete;
+   EpisodeTask& operator=(const EpisodeTask&) = delete;
+   ~EpisodeTask();
+
+   bool done() const;
+
+private:
+
+   friend class EpisodeScheduler;
+   std::coroutine_handle<promise_type> handle;
+};
+
+/*
+ * Interleaves many robot coroutines on a few OS threads. A robot co_awaits at(time) for its next event (IMU sample, sensor
+ * frame, decision, ...) in virtual time; the scheduler resumes the waiting robots in virtual time order, so a single thread
+ * can run thousands of episodes side by side, and in real time too (setRealTime(..)) instead of one paced thread per robot.
+ * With more than one thread every worker has its own queue (a heap ordered by virtual time) and an idle worker steals the
+ * earliest robot of another worker's queue; a worker that finds nothing to run or steal sleeps until a robot is queued.
+ * A robot is only ever run by one worker at a time but may move between workers, so it must not rely on thread locals.
+*/
+class EpisodeScheduler
+{
+   struct Entry
+   {
+      double time;
+      uint64_t seq;
+      std::coroutine_handle<> handle;
+   };
+
+   struct Later
+   {
+      bool operator()(const Entry& a, const Entry& b) const
+      {
+         return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+      }
+   };
+
+   struct Queue
+   {
+      std::mutex lock;
+      std::vector<Entry> heap;
+   };
+
+   std::vector<std::unique_ptr<Queue>> queues;
+   std::atomic<size_t> live; /* spawned robots that did not finish yet */
+   std::atomic<uint64_t> seq;
+   std::atomic<uint64_t> pushed; /* robots queued so far, bumped once the robot is in its queue */
+   std::atomic<unsigned int> sleeping; /* idle workers waiting on 'wake' */
+   std::mutex idlelock;
+   std::condition_variable wake; /* a robot was queued or all are done */
+   std::atomic<uint64_t> steals;
+   std::atomic<uint64_t> resumes;
+   size_t nextQueue; /* spawn(..) round robin */
+   bool realtime;
+   std::chrono::steady_clock::time_point wallstart;
+
+   void push(size_t queue, double time, std::coroutine_handle<> handle);
+
+   bool pop(size_t queue, Entry& entry);
+
+   bool steal(size_t thief, Entry& entry);
+
+   void work(size_t queue);
+
+   void sleep(uint64_t seen);
+
+   void wakeUp(bool all);
+
+public:
+
+   /*
+    * What a robot co_awaits, see at(..).
+   */
+   struct Wait
+   {
+      EpisodeScheduler* scheduler;
+      double time;
+
+      bool await_ready() const noexcept { return false; }
+      void await_suspend(std::coroutine_handle<> handle);
+      void await_resume() const noexcept {}
+   };
+
+   EpisodeScheduler(unsigned int threads = 1);
+
+   void setRealTime(bool realtime);
+
+   void spawn(EpisodeTask& task);
+
+   Wait at(double time);
+
+   void run();
+
+   void finished();
+
+   unsigned int getThreads() const;
+
+   uint64_t getSteals() const;
+
+   uint64_t getResumes() const;
+
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "EventClock.hpp"
+#include <thread>
+
+EventClock::EventClock(): start(0.0), now(0.0), seq(0), realtime(false) {}
+
+/*
+ * Drops all pending events and restarts the clock at 'start'.
+*/
+void EventClock::reset(double start)
+{
+   events.clear();
+   this->start = start;
+   now = start;
+   seq = 0;
+   wallstart = std::chrono::steady_clock::now();
+}
+
+void EventClock::setRealTime(bool realtime)
+{
+   this->realtime = realtime;
+}
+
+/*
+ * Events in the past are moved to 'now'.
+*/
+void EventClock::schedule(double time, SimEventType type)
+{
+   SimEvent event;
+   event.time = time < now ? now : time;
+   event.type = type;
+   event.seq = seq++;
+   events.push_back(event);
+   std::push_heap(events.begin(), events.end(), Later());
+}
+
+/*
+ * Pops the earliest event and advances the clock to it, false when nothing is scheduled anymore.
+*/
+bool EventClock::next(SimEvent& event)
+{
+   if(events.empty())
+      return false;
+   std::pop_heap(events.begin(), events.end(), Later());
+   event = events.back();
+   events.pop_back();
+   now = event.time;
+   if(realtime)
+      std::this_thread::sleep_until(wallstart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                   std::chrono::duration<double>(now - start)));
+   return true;
+}
+
+double EventClock::getTime() const
+{
+   return now;
+}
@@ -0,0 +1,58 @@
+#ifndef _EVENTCLOCK_
+#define _EVENTCLOCK_
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+/*
+ * What happens at a point in simulated time.
+*/
+enum SimEventType{ EVENT_PERTURBATION, EVENT_DECISION, EVENT_SENSOR, EVENT_IMU };
+
+struct SimEvent
+{
+   double time;
+   SimEventType type;
+   unsigned long seq; /* events at the same time come out in the order they were scheduled */
+};
+
+/*
+ * Discrete-event scheduler with a virtual clock: next(..) jumps straight to the earliest scheduled event, so simulated time 
+ * costs nothing by itself. In real-time mode next(..) sleeps until the wall clock (since reset(..)) catches up with the event,
+ * e.g. for hardware-in-the-loop tests.
+*/
+class EventClock
+{
+   struct Later
+   {
+      bool operator()(const SimEvent& a, const SimEvent& b) const
+      {
+         return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+      }
+   };
+
+   std::vector<SimEvent> events; /* heap ordered by 'Later', kept across reset(..) to avoid re-allocating per episode */
+   double start;
+   double now;
+   unsigned long seq;
+   bool realtime;
+   std::chrono::steady_clock::time_point wallstart;
+
+public:
+
+   EventClock();
+
+   void reset(double start);
+
+   void setRealTime(bool realtime);
+
+   void schedule(double time, SimEventType type);
+
+   bool next(SimEvent& event);
+
+   double getTime() const;
+
+};
+
+#endif
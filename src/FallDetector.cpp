@@ -0,0 +1,45 @@
+#include "FallDetector.hpp"
+
+FallDetector::FallDetector(): threshold(1), window(0), seen(0), run(0), outcome(FALL_UNDECIDED) {}
+
+void FallDetector::reset(unsigned int threshold, unsigned int window)
+{
+   this->threshold = threshold > 0 ? threshold : 1;
+   this->window    = window;
+   seen    = 0;
+   run     = 0;
+   outcome = FALL_UNDECIDED;
+}
+
+/*
+ * Samples after the outcome is decided don't change it.
+*/
+FallOutcome FallDetector::push(FeetState fstate)
+{
+   if(outcome != FALL_UNDECIDED)
+      return outcome;
+   seen++;
+   if(fstate == ZERO_FSRS)
+      run++;
+   else
+      run = 0;
+
+   if(run >= threshold)
+      outcome = FALL_FELL;
+   else if(window > 0 && (seen >= window || (window - seen) + run < threshold))
+      outcome = FALL_SURVIVED;
+   return outcome;
+}
+
+FallOutcome FallDetector::getOutcome() const
+{
+   return outcome;
+}
+
+/*
+ * # of samples it took to decide (or seen so far).
+*/
+unsigned int FallDetector::getSeen() const
+{
+   return seen;
+}
@@ -0,0 +1,35 @@
+#ifndef _FALLDETECTOR_
+#define _FALLDETECTOR_
+
+#include "core.hpp"
+
+enum FallOutcome{ FALL_UNDECIDED, FALL_FELL, FALL_SURVIVED };
+
+/*
+ * Streaming fall detection over the FeetState samples of the watch window after an action: the robot fell once 'threshold'
+ * consecutive samples have no foot on the ground (ZERO_FSRS), it survived as soon as the rest of the window is too short for
+ * that to happen. O(1) state & work per sample, so the caller can stop watching as soon as the outcome is known.
+*/
+class FallDetector
+{
+   unsigned int threshold;
+   unsigned int window; /* 0 = unbounded, only a fall can be decided */
+   unsigned int seen;
+   unsigned int run; /* current # of consecutive ZERO_FSRS samples */
+   FallOutcome outcome;
+
+public:
+
+   FallDetector();
+
+   void reset(unsigned int threshold, unsigned int window);
+
+   FallOutcome push(FeetState fstate);
+
+   FallOutcome getOutcome() const;
+
+   unsigned int getSeen() const;
+
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "ImpactDetector.hpp"
+
+ImpactDetector::ImpactDetector()
+{
+   configure(4, 2.0, 1.0);
+}
+
+/*
+ * 'window' is clamped to [1, MAX_WINDOW]. Resets the detector.
+*/
+void ImpactDetector::configure(unsigned int window, double threshold, double gyroweight)
+{
+   if(window == 0)
+      window = 1;
+   if(window > MAX_WINDOW)
+      window = MAX_WINDOW;
+   this->window     = window;
+   this->threshold  = threshold;
+   this->gyroweight = gyroweight;
+   reset();
+}
+
+void ImpactDetector::reset()
+{
+   for(unsigned int i = 0; i < window; i++)
+      energies[i] = 0.0;
+   head = 0;
+   sum = 0.0;
+   samples = 0;
+}
+
+/*
+ * Feed the next sample, true while the windowed energy is above the threshold. The very first sample only primes the jerk.
+*/
+bool ImpactDetector::push(const ImuSample& sample)
+{
+   double energy = 0.0;
+   if(samples > 0)
+   {
+      for(int i = 0; i < 3; i++)
+      {
+         double jerk = sample.accel[i] - last.accel[i];
+         energy += (jerk * jerk) + (gyroweight * sample.gyro[i] * sample.gyro[i]);
+      }
+   }
+   last = sample;
+   samples++;
+
+   sum += energy - energies[head];
+   energies[head] = energy;
+   head = (head + 1) % window;
+   return sum > threshold;
+}
+
+double ImpactDetector::getEnergy() const
+{
+   return sum;
+}
+
+unsigned long ImpactDetector::getSamples() const
+{
+   return samples;
+}
@@ -0,0 +1,42 @@
+#ifndef _IMPACTDETECTOR_
+#define _IMPACTDETECTOR_
+
+#include "core.hpp"
+
+/*
+ * Streaming impact (perturbation) detection over IMU samples: the energy of a sample is the squared jerk (change of
+ * acceleration since the previous sample) plus 'gyroweight' times the squared angular rate, and an impact is reported when 
+ * the energy summed over the last 'window' samples goes above 'threshold'. O(1) work & state per sample (ring buffer with a
+ * running sum).
+*/
+class ImpactDetector
+{
+   static const unsigned int MAX_WINDOW = 32;
+
+   unsigned int window;
+   double threshold;
+   double gyroweight;
+
+   double energies[MAX_WINDOW];
+   unsigned int head;
+   double sum;
+   ImuSample last;
+   unsigned long samples;
+
+public:
+
+   ImpactDetector();
+
+   void configure(unsigned int window, double threshold, double gyroweight);
+
+   void reset();
+
+   bool push(const ImuSample& sample);
+
+   double getEnergy() const;
+
+   unsigned long getSamples() const;
+
+};
+
+#endif
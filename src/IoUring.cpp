@@ -0,0 +1,297 @@
+#include "IoUring.hpp"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <atomic>
+#include <algorithm>
+
+static const uint64_t FSYNC_TAG = UINT64_MAX;
+
+static int ioUringSetup(unsigned int entries, io_uring_params* params)
+{
+   return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned int submit, unsigned int complete, unsigned int flags)
+{
+   return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int ioUringRegister(int fd, unsigned int opcode, void* arg, unsigned int count)
+{
+   return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/*
+ * The ring indices are shared with the kernel.
+*/
+static unsigned loadAcquire(unsigned* p)
+{
+   return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+}
+
+static void storeRelease(unsigned* p, unsigned value)
+{
+   std::atomic_ref<unsigned>(*p).store(value, std::memory_order_release);
+}
+
+IoUring::IoUring(): ringfd(-1), sqring(MAP_FAILED), cqring(MAP_FAILED), sqringsize(0), cqringsize(0), sqes((io_uring_sqe*) MAP_FAILED),
+                    sqessize(0), sqentries(0), buffersize(0), queued(0) {}
+
+IoUring::~IoUring()
+{
+   release();
+}
+
+void IoUring::release()
+{
+   if(ringfd >= 0)
+      close(ringfd); /* also unregisters the buffers */
+   if(cqring != MAP_FAILED && cqring != sqring)
+      munmap(cqring, cqringsize);
+   if(sqring != MAP_FAILED)
+      munmap(sqring, sqringsize);
+   if(sqes != (io_uring_sqe*) MAP_FAILED)
+      munmap(sqes, sqessize);
+   for(size_t i = 0; i < buffers.size(); i++)
+      free(buffers[i]);
+   buffers.clear();
+   slots.clear();
+   ringfd = -1;
+   sqring = cqring = MAP_FAILED;
+   sqes = (io_uring_sqe*) MAP_FAILED;
+}
+
+/*
+ * Sets up the ring and registers 'count' page aligned buffers of 'size' bytes, false (errno set) if io_uring is not usable.
+*/
+bool IoUring::init(unsigned int count, size_t size)
+{
+   release();
+   io_uring_params params;
+   memset(&params, 0, sizeof(params));
+   ringfd = ioUringSetup(count + 1, &params); /* a write per buffer + the fsync */
+   if(ringfd < 0)
+      return false;
+   sqringsize = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+   cqringsize = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+   if(params.features & IORING_FEAT_SINGLE_MMAP)
+      sqringsize = cqringsize = std::max(sqringsize, cqringsize);
+   sqring = mmap(NULL, sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+   if(sqring == MAP_FAILED)
+   {
+      int error = errno;
+      release();
+      errno = error;
+      return false;
+   }
+   if(params.features & IORING_FEAT_SINGLE_MMAP)
+      cqring = sqring;
+   else
+      cqring = mmap(NULL, cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+   sqessize = params.sq_entries * sizeof(io_uring_sqe);
+   sqes = (io_uring_sqe*) mmap(NULL, sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+   if(cqring == MAP_FAILED || sqes == (io_uring_sqe*) MAP_FAILED)
+   {
+      int error = errno;
+      release();
+      errno = error;
+      return false;
+   }
+   char* sq = (char*) sqring;
+   char* cq = (char*) cqring;
+   sqhead = (unsigned*) (sq + params.sq_off.head);
+   sqtail = (unsigned*) (sq + params.sq_off.tail);
+   sqmask = (unsigned*) (sq + params.sq_off.ring_mask);
+   sqarray = (unsigned*) (sq + params.sq_off.array);
+   sqentries = params.sq_entries;
+   cqhead = (unsigned*) (cq + params.cq_off.head);
+   cqtail = (unsigned*) (cq + params.cq_off.tail);
+   cqmask = (unsigned*) (cq + params.cq_off.ring_mask);
+   cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+
+   std::vector<iovec> iovecs(count);
+   for(unsigned int i = 0; i < count; i++)
+   {
+      void* buffer = NULL;
+      if(posix_memalign(&buffer, 4096, size) != 0)
+      {
+         release();
+         errno = ENOMEM;
+         return false;
+      }
+      buffers.push_back((char*) buffer);
+      iovecs[i].iov_base = buffer;
+      iovecs[i].iov_len = size;
+   }
+   if(ioUringRegister(ringfd, IORING_REGISTER_BUFFERS, iovecs.data(), count) < 0)
+   {
+      int error = errno;
+      release();
+      errno = error;
+      return false;
+   }
+   buffersize = size;
+   slots.assign(count, Slot());
+   queued = 0;
+   return true;
+}
+
+bool IoUring::isReady() const
+{
+   return ringfd >= 0;
+}
+
+/*
+ * Next free submission entry (zeroed), NULL if the ring is full. Becomes visible to the kernel with the next enter(..).
+*/
+io_uring_sqe* IoUring::getSqe()
+{
+   unsigned tail = *sqtail;
+   if(tail - loadAcquire(sqhead) >= sqentries)
+      return NULL;
+   unsigned index = tail & *sqmask;
+   io_uring_sqe* sqe = &sqes[index];
+   memset(sqe, 0, sizeof(*sqe));
+   sqarray[index] = index;
+   storeRelease(sqtail, tail + 1);
+   queued++;
+   return sqe;
+}
+
+/*
+ * (The rest of) the chunk of a slot, from its registered buffer.
+*/
+void IoUring::submitWrite(int fd, unsigned int slot)
+{
+   Slot& s = slots[slot];
+   io_uring_sqe* sqe = getSqe(); /* never NULL, there is an entry per slot */
+   sqe->opcode = IORING_OP_WRITE_FIXED;
+   sqe->fd = fd;
+   sqe->addr = (uint64_t) (uintptr_t) (buffers[slot] + s.done);
+   sqe->len = s.length - s.done;
+   sqe->off = s.offset + s.done;
+   sqe->buf_index = slot;
+   sqe->user_data = slot;
+}
+
+/*
+ * Submits the queued entries and waits for at least 'waitfor' completions.
+*/
+bool IoUring::enter(unsigned int waitfor)
+{
+   while(true)
+   {
+      int submitted = ioUringEnter(ringfd, queued, waitfor, waitfor ? IORING_ENTER_GETEVENTS : 0);
+      if(submitted >= 0)
+      {
+         queued -= std::min<unsigned int>(queued, submitted);
+         return true;
+      }
+      if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+         return false;
+   }
+}
+
+/*
+ * Gives up on the ring after io_uring_enter(..) failed with writes still in flight: their completions cannot be waited for,
+ * so the buffers may still be in use. Closing the ring has the kernel cancel them and keeps the (pinned) buffers away from
+ * the next write; isReady() is false from then on, the caller goes on with pwrite.
+*/
+void IoUring::abandon()
+{
+   int error = errno;
+   release();
+   errno = error;
+}
+
+/*
+ * Writes 'size' bytes to 'fd' from offset 0 on, chunk by chunk through the registered buffers with all buffers in flight at
+ * once, and fdatasyncs afterwards if 'sync'. Blocks the calling (writer) thread until done, also when a write fails: the
+ * chunks in flight are waited for before returning. If the ring itself fails it is abandoned, see abandon().
+*/
+bool IoUring::writeFile(int fd, const char* data, size_t size, bool sync)
+{
+   if(!isReady())
+      return false;
+   size_t pos = 0;
+   unsigned int inflight = 0;
+   bool ok = true;
+   while((ok && pos < size) || inflight > 0)
+   {
+      for(unsigned int i = 0; i < slots.size() && ok && pos < size; i++)
+      {
+         if(slots[i].busy)
+            continue;
+         Slot& slot = slots[i];
+         slot.offset = pos;
+         slot.length = std::min(buffersize, size - pos);
+         slot.done = 0;
+         slot.busy = true;
+         memcpy(buffers[i], data + pos, slot.length);
+         submitWrite(fd, i);
+         pos += slot.length;
+         inflight++;
+      }
+      if(!enter(1))
+      {
+         abandon();
+         return false;
+      }
+      unsigned head = *cqhead;
+      unsigned tail = loadAcquire(cqtail);
+      for(; head != tail; head++)
+      {
+         io_uring_cqe* cqe = &cqes[head & *cqmask];
+         Slot& slot = slots[cqe->user_data];
+         if(cqe->res > 0)
+            slot.done += cqe->res;
+         if(cqe->res > 0 && slot.done < slot.length)
+         {
+            submitWrite(fd, cqe->user_data);
+            continue;
+         }
+         if(cqe->res <= 0)
+         {
+            errno = cqe->res < 0 ? -cqe->res : EIO;
+            ok = false;
+         }
+         slot.busy = false;
+         inflight--;
+      }
+      storeRelease(cqhead, head);
+   }
+   if(!ok || !sync)
+      return ok;
+
+   io_uring_sqe* sqe = getSqe();
+   if(!sqe)
+      return fdatasync(fd) == 0; /* the ring is still full of entries enter(..) left queued */
+   sqe->opcode = IORING_OP_FSYNC;
+   sqe->fd = fd;
+   sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+   sqe->user_data = FSYNC_TAG;
+   if(!enter(1))
+   {
+      abandon();
+      return false;
+   }
+   unsigned head = *cqhead;
+   unsigned tail = loadAcquire(cqtail);
+   for(; head != tail; head++)
+   {
+      io_uring_cqe* cqe = &cqes[head & *cqmask];
+      if(cqe->user_data == FSYNC_TAG && cqe->res < 0)
+      {
+         errno = -cqe->res;
+         ok = false;
+      }
+   }
+   storeRelease(cqhead, head);
+   return ok;
+}
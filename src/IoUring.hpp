@@ -0,0 +1,72 @@
+#ifndef _IOURING_
+#define _IOURING_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * Minimal io_uring (Linux >= 5.1) on the raw syscalls, no liburing: one submission/completion ring plus a few buffers
+ * registered with the kernel once, so that writes (IORING_OP_WRITE_FIXED) neither map nor pin user memory per call.
+ * Only what AsyncWriter needs: writing a whole file through the registered buffers, several chunks in flight, then an
+ * fdatasync. Not thread-safe, one thread owns the ring. init(..) fails (and the caller falls back to pwrite) when the kernel
+ * has no io_uring, it is disabled (kernel.io_uring_disabled, seccomp) or the buffers cannot be registered (RLIMIT_MEMLOCK).
+*/
+class IoUring
+{
+   struct Slot
+   {
+      uint64_t offset; /* in the file */
+      size_t length;
+      size_t done; /* bytes written so far, a short write is resubmitted */
+      bool busy;
+   };
+
+   int ringfd;
+   void* sqring;
+   void* cqring;
+   size_t sqringsize, cqringsize;
+   io_uring_sqe* sqes;
+   size_t sqessize;
+   unsigned* sqhead;
+   unsigned* sqtail;
+   unsigned* sqmask;
+   unsigned* sqarray;
+   unsigned sqentries;
+   unsigned* cqhead;
+   unsigned* cqtail;
+   unsigned* cqmask;
+   io_uring_cqe* cqes;
+   std::vector<char*> buffers;
+   std::vector<Slot> slots;
+   size_t buffersize;
+   unsigned int queued; /* sqes not submitted yet */
+
+   io_uring_sqe* getSqe();
+
+   void submitWrite(int fd, unsigned int slot);
+
+   bool enter(unsigned int waitfor);
+
+   void release();
+
+   void abandon();
+
+public:
+
+   IoUring();
+
+   ~IoUring();
+
+   bool init(unsigned int buffers, size_t buffersize);
+
+   bool isReady() const;
+
+   bool writeFile(int fd, const char* data, size_t size, bool sync);
+
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "PerfCounters.hpp"
+#include "log.hpp"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char* const REGION_NAMES[PERF_REGIONS] = { "getQValue", "update", "justPolicy", "getCurrentPolicy", "loadQTable" };
+
+static const uint64_t EVENT_CONFIGS[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                     PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+struct RegionStats
+{
+   std::atomic<uint64_t> calls;
+   std::atomic<uint64_t> counted; /* calls with valid hardware counters */
+   std::atomic<uint64_t> nanos;
+   std::atomic<uint64_t> events[PERF_EVENTS];
+};
+
+static RegionStats stats[PERF_REGIONS];
+static std::atomic<int> openError(0); /* errno of the last failed perf_event_open, 0 if none */
+
+/*
+ * One counter group (led by the cycles counter) per thread, read with a single read(2).
+*/
+struct ThreadCounters
+{
+   int fds[PERF_EVENTS];
+   bool opened;
+
+   ThreadCounters(): opened(false)
+   {
+      for(int i = 0; i < PERF_EVENTS; i++)
+         fds[i] = -1;
+   }
+
+   ~ThreadCounters()
+   {
+      for(int i = 0; i < PERF_EVENTS; i++)
+         if(fds[i] >= 0)
+            close(fds[i]);
+   }
+
+   void open()
+   {
+      opened = true;
+      for(int i = 0; i < PERF_EVENTS; i++)
+      {
+         struct perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size = sizeof(attr);
+         attr.type = PERF_TYPE_HARDWARE;
+         attr.config = EVENT_CONFIGS[i];
+         attr.disabled = (i == 0);
+         attr.exclude_kernel = 1;
+         attr.exclude_hv = 1;
+         attr.read_format = PERF_FORMAT_GROUP;
+         fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+         if(fds[i] < 0)
+         {
+            openError = errno;
+            for(int j = 0; j < i; j++)
+            {
+               close(fds[j]);
+               fds[j] = -1;
+            }
+            return;
+         }
+      }
+      ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+   }
+};
+
+static thread_local ThreadCounters counters;
+
+void setPerfCounting(bool enabled)
+{
+   perfEnabled() = enabled;
+}
+
+void readPerfCounters(PerfSample& sample)
+{
+   if(!counters.opened)
+      counters.open();
+   sample.valid = false;
+   if(counters.fds[0] >= 0)
+   {
+      struct
+      {
+         uint64_t nr;
+         uint64_t values[PERF_EVENTS];
+      } group;
+      if(read(counters.fds[0], &group, sizeof(group)) == (ssize_t) sizeof(group) && group.nr == PERF_EVENTS)
+      {
+         memcpy(sample.values, group.values, sizeof(sample.values));
+         sample.valid = true;
+      }
+   }
+   sample.time = std::chrono::steady_clock::now();
+}
+
+void addPerfSample(PerfRegion region, const PerfSample& start, const PerfSample& end)
+{
+   RegionStats& stat = stats[region];
+   stat.calls.fetch_add(1, std::memory_order_relaxed);
+   stat.nanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end.time - start.time).count(),
+                        std::memory_order_relaxed);
+   if(!start.valid || !end.valid)
+      return;
+   stat.counted.fetch_add(1, std::memory_order_relaxed);
+   for(int i = 0; i < PERF_EVENTS; i++)
+      stat.events[i].fetch_add(end.values[i] - start.values[i], std::memory_order_relaxed);
+}
+
+void resetPerfCounters()
+{
+   for(int r = 0; r < PERF_REGIONS; r++)
+   {
+      stats[r].calls = 0;
+      stats[r].counted = 0;
+      stats[r].nanos = 0;
+      for(int i = 0; i < PERF_EVENTS; i++)
+         stats[r].events[i] = 0;
+   }
+}
+
+/*
+ * Per call averages of every region that was called. The counters include the cost of reading them (~1-2k cycles per call
+ * for the two read(2)s, mostly in the kernel and so not counted, but it does pollute the caches).
+*/
+void printPerfReport()
+{
+   REPORT("Per-call hardware counters (user space)\n");
+   int error = openError;
+   if(error)
+      REPORT("  hardware counters unavailable: %s%s, timing only\n", strerror(error),
+             (error == EACCES || error == EPERM) ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+   REPORT("  %-17s %10s %10s %10s %10s %6s %10s %10s\n", "region", "calls", "ns", "cycles", "instr", "IPC", "cache-miss",
+          "branch-miss");
+   for(int r = 0; r < PERF_REGIONS; r++)
+   {
+      uint64_t calls = stats[r].calls;
+      if(calls == 0)
+         continue;
+      uint64_t counted = stats[r].counted;
+      if(counted == 0)
+      {
+         REPORT("  %-17s %10lu %10.1f %10s %10s %6s %10s %10s\n", REGION_NAMES[r], (unsigned long) calls,
+                (double) stats[r].nanos / calls, "-", "-", "-", "-", "-");
+         continue;
+      }
+      double per[PERF_EVENTS];
+      for(int i = 0; i < PERF_EVENTS; i++)
+         per[i] = (double) stats[r].events[i] / counted;
+      REPORT("  %-17s %10lu %10.1f %10.1f %10.1f %6.2f %10.2f %10.2f\n", REGION_NAMES[r], (unsigned long) calls,
+             (double) stats[r].nanos / calls, per[PERF_CYCLES], per[PERF_INSTRUCTIONS],
+             per[PERF_CYCLES] > 0.0 ? per[PERF_INSTRUCTIONS] / per[PERF_CYCLES] : 0.0, per[PERF_CACHE_MISSES],
+             per[PERF_BRANCH_MISSES]);
+   }
+}
@@ -0,0 +1,78 @@
+#ifndef _PERFCOUNTERS_
+#define _PERFCOUNTERS_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+/*
+ * Optional hardware counters (Linux perf_event_open) around instrumented regions of the learner: cycles, instructions, cache
+ * misses & branch misses per call next to the wall time, to tell memory-bound from branch-bound code. Off by default, an
+ * instrumented region then costs one branch. Counting is per thread (the counters of a thread are opened on its first
+ * instrumented call) and user space only, the totals of all threads are summed up per region.
+*/
+enum PerfRegion{ PERF_GET_QVALUE, PERF_UPDATE, PERF_JUST_POLICY, PERF_CURRENT_POLICY, PERF_LOAD_QTABLE, PERF_REGIONS };
+
+enum PerfEvent{ PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+/*
+ * Snapshot of the counters of the calling thread, 'valid' is false if they could not be opened (no PMU,
+ * perf_event_paranoid, seccomp, ...), then only the time is measured.
+*/
+struct PerfSample
+{
+   uint64_t values[PERF_EVENTS];
+   std::chrono::steady_clock::time_point time;
+   bool valid;
+};
+
+inline std::atomic<bool>& perfEnabled()
+{
+   static std::atomic<bool> enabled(false);
+   return enabled;
+}
+
+void setPerfCounting(bool enabled);
+
+void readPerfCounters(PerfSample& sample);
+
+void addPerfSample(PerfRegion region, const PerfSample& start, const PerfSample& end);
+
+void resetPerfCounters();
+
+void printPerfReport();
+
+/*
+ * Counts the enclosing scope as one call of 'region'.
+*/
+class PerfScope
+{
+   PerfRegion region;
+   bool active;
+   PerfSample start;
+
+public:
+
+   explicit PerfScope(PerfRegion region): region(region), active(perfEnabled().load(std::memory_order_relaxed))
+   {
+      if(active)
+         readPerfCounters(start);
+   }
+
+   ~PerfScope()
+   {
+      if(active)
+      {
+         PerfSample end;
+         readPerfCounters(end);
+         addPerfSample(region, start, end);
+      }
+   }
+
+   PerfScope(const PerfScope&) = delete;
+
+   PerfScope& operator=(const PerfScope&) = delete;
+
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "PolicyEvaluator.hpp"
+#include <thread>
+#include <atomic>
+
+double EvaluationResult::getSurvivalRate() const
+{
+   return (survived + fell) ? (double) survived / (survived + fell) : 0.0;
+}
+
+PolicyEvaluator::PolicyEvaluator(const std::string& policyPath, unsigned int threads, unsigned int maxsteps,
+                                 uint64_t seed): policyPath(policyPath), threads(threads), maxsteps(maxsteps), seed(seed) {}
+
+/*
+ * Wilson score interval of a binomial proportion, 'z' standard deviations wide (1.96 for 95%). Unlike the normal
+ * approximation it stays inside [0, 1] and is usable for rates close to 0 or 1.
+*/
+void PolicyEvaluator::getWilsonInterval(unsigned long successes, unsigned long trials, double z, double& low, double& high)
+{
+   if(trials == 0)
+   {
+      low = 0.0;
+      high = 1.0;
+      return;
+   }
+   double n = trials;
+   double p = successes / n;
+   double z2 = z * z;
+   double center = (p + (z2 / (2.0 * n))) / (1.0 + (z2 / n));
+   double margin = (z / (1.0 + (z2 / n))) * sqrt(((p * (1.0 - p)) / n) + (z2 / (4.0 * n * n)));
+   low = std::max(0.0, center - margin);
+   high = std::min(1.0, center + margin);
+}
+
+/*
+ * Runs 'episodes' episodes, handed out to the workers in chunks. False if the 'policy' could not be loaded.
+*/
+bool PolicyEvaluator::evaluate(unsigned long episodes, EvaluationResult& result)
+{
+   unsigned int workers = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+   const unsigned long chunk = 256;
+   uint64_t base = seed ? seed : (uint64_t) time(NULL);
+
+   std::atomic<unsigned long> next(0);
+   std::atomic<unsigned long> survived(0), fell(0), undetected(0);
+   std::atomic<bool> failed(false);
+   auto worker = [&](unsigned int id) {
+      std::unique_ptr<QLearningSimulate> simulate(new QLearningSimulate("", policyPath));
+      if(!simulate->loadPolicy())
+      {
+         failed = true;
+         return;
+      }
+      simulate->setEvaluation(true);
+      simulate->seed(base * 0x9e3779b97f4a7c15ULL + id + 1);
+      unsigned long s = 0, f = 0, u = 0;
+      unsigned long first;
+      while(!failed && (first = next.fetch_add(chunk)) < episodes)
+      {
+         unsigned long last = std::min(episodes, first + chunk);
+         for(unsigned long e = first; e < last; e++)
+         {
+            int outcome = simulate->runEpisode(maxsteps);
+            if(outcome == 1)
+               s++;
+            else if(outcome == 0)
+               f++;
+            else
+               u++;
+         }
+      }
+      survived += s;
+      fell += f;
+      undetected += u;
+   };
+
+   typedef std::chrono::steady_clock Clock;
+   Clock::time_point start = Clock::now();
+   std::vector<std::thread> pool;
+   for(unsigned int t = 0; t < workers; t++)
+      pool.push_back(std::thread(worker, t));
+   for(size_t t = 0; t < pool.size(); t++)
+      pool[t].join();
+   if(failed)
+      return false;
+
+   result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+   result.survived = survived;
+   result.fell = fell;
+   result.undetected = undetected;
+   result.episodes = result.survived + result.fell + result.undetected;
+   getWilsonInterval(result.survived, result.survived + result.fell, 1.959964, result.low, result.high);
+   return true;
+}
@@ -0,0 +1,41 @@
+#ifndef _POLICYEVALUATOR_
+#define _POLICYEVALUATOR_
+
+#include "QLearningSimulate.hpp"
+
+struct EvaluationResult
+{
+   unsigned long episodes;
+   unsigned long survived;
+   unsigned long fell;
+   unsigned long undetected; /* episodes without a (detected) perturbation */
+   double seconds;
+   double low, high; /* 95% Wilson score interval of the survival rate */
+
+   double getSurvivalRate() const;
+};
+
+/*
+ * Measures how good a stored policy is without touching it: every worker thread loads the 'policy' file (read only, the
+ * 'q-table' is not loaded at all) into its own simulator, acts with QLearner::justPolicy(..) and never updates or saves
+ * anything, see QLearningSimulate::setEvaluation(..).
+*/
+class PolicyEvaluator
+{
+   std::string policyPath;
+   unsigned int threads; /* 0 = one per core */
+   unsigned int maxsteps; /* per episode, see TrainOptions::maxSteps */
+   uint64_t seed;
+
+public:
+
+   PolicyEvaluator(const std::string& policyPath, unsigned int threads = 0, unsigned int maxsteps = TrainOptions().maxSteps,
+                   uint64_t seed = 0);
+
+   bool evaluate(unsigned long episodes, EvaluationResult& result);
+
+   static void getWilsonInterval(unsigned long successes, unsigned long trials, double z, double& low, double& high);
+
+};
+
+#endif
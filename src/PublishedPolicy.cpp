@@ -0,0 +1,112 @@
+#include "PublishedPolicy.hpp"
+#include <float.h>
+
+PublishedPolicy::PublishedPolicy(): sequence(0), known(0), evictions(0)
+{
+   for(int s = 0; s < 16; s++)
+   {
+      actions[s] = 0;
+      max[s] = -DBL_MAX;
+      for(int c = 0; c < 2; c++)
+         copies[c].actions[s].store(0, std::memory_order_relaxed);
+   }
+   for(int c = 0; c < 2; c++)
+      copies[c].known.store(0, std::memory_order_relaxed);
+}
+
+/*
+ * Latch step 1 moves the readers to copies[1] and updates copies[0], step 2 moves them back and updates copies[1]. The
+ * release fences order every sequence step before the stores that follow it (see read(..)).
+*/
+void PublishedPolicy::write()
+{
+   uint64_t seq = sequence.load(std::memory_order_relaxed);
+   for(int c = 0; c < 2; c++)
+   {
+      sequence.store(seq + c + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for(int s = 0; s < 16; s++)
+         copies[c].actions[s].store(actions[s], std::memory_order_relaxed);
+      copies[c].known.store(known, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+   }
+}
+
+/*
+ * Rescans 'state', true if its greedy action changed.
+*/
+bool PublishedPolicy::refresh(const QStore& table, int state)
+{
+   long pos = table.argmax((FeetState) state);
+   uint16_t bit = 1u << state;
+   if(pos < 0)
+   {
+      max[state] = -DBL_MAX;
+      bool changed = known & bit;
+      known &= ~bit;
+      return changed;
+   }
+   max[state] = table.getQValue((FeetState) state, pos);
+   uint64_t action = table.getKey((FeetState) state, pos);
+   bool changed = !(known & bit) || actions[state] != action;
+   actions[state] = action;
+   known |= bit;
+   return changed;
+}
+
+/*
+ * Publishes the greedy policy of all of 'table', e.g. after loading it.
+*/
+void PublishedPolicy::publish(const QStore& table)
+{
+   for(int s = 0; s < 16; s++)
+      refresh(table, s);
+   evictions = table.getEvictions();
+   write();
+}
+
+/*
+ * Q(state, action) was just set to 'qvalue' (updated or inserted) in 'table': republishes if that changed the argmax of
+ * 'state'. Evictions can take the greedy action of any state away, so then everything is rescanned.
+*/
+void PublishedPolicy::update(const QStore& table, FeetState state, uint64_t action, double qvalue)
+{
+   if(table.getEvictions() != evictions)
+   {
+      publish(table);
+      return;
+   }
+   bool greedy = (known & (1u << state)) && actions[state] == action;
+   if(!greedy && QStore::round(qvalue) < max[state])
+      return;
+   if(refresh(table, state))
+      write();
+}
+
+/*
+ * Lock free: copies the policy the writer published last (or the one before, if a publication is half way through).
+*/
+void PublishedPolicy::read(GreedyPolicy& policy) const
+{
+   uint64_t before, after;
+   do
+   {
+      before = sequence.load(std::memory_order_acquire);
+      const Copy& copy = copies[before & 1];
+      for(int s = 0; s < 16; s++)
+         policy.actions[s] = copy.actions[s].load(std::memory_order_relaxed);
+      policy.known = copy.known.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+   }
+   while(before != after);
+   policy.version = before / 2;
+}
+
+/*
+ * # of publications so far.
+*/
+uint64_t PublishedPolicy::getVersion() const
+{
+   return sequence.load(std::memory_order_acquire) / 2;
+}
@@ -0,0 +1,63 @@
+#ifndef _PUBLISHEDPOLICY_
+#define _PUBLISHEDPOLICY_
+
+#include "QStore.hpp"
+#include <atomic>
+
+/*
+ * A consistent copy of the greedy policy: the action (Action::getKey()) of every FeetState, for the states with a bit in
+ * 'known' (nothing tried there yet otherwise).
+*/
+struct GreedyPolicy
+{
+   uint64_t actions[16];
+   uint16_t known;
+   uint64_t version; /* # of publications before this one */
+};
+
+/*
+ * Greedy policy of a 'Q' table published for a control thread while another thread learns. One writer (the learner,
+ * see QLearner::publishPolicy()), any number of readers: the 16 entries are kept twice behind a sequence counter (a
+ * seqcount latch), the writer updates one copy while the readers use the other, so read(..) takes no lock and never waits
+ * for a write in progress; it only reads again if a whole write step slipped in while it was copying.
+ * The writer side keeps the max q-value of every state, so that update(..) only rescans a state when its greedy action
+ * changed or another action got as good, and only publishes when an argmax actually changed.
+*/
+class PublishedPolicy
+{
+   struct alignas(64) Copy
+   {
+      std::atomic<uint64_t> actions[16];
+      std::atomic<uint32_t> known;
+   };
+
+   alignas(64) std::atomic<uint64_t> sequence; /* even: readers use copies[0], odd: copies[1] */
+   Copy copies[2];
+
+   /*
+    * Writer side only.
+   */
+   uint64_t actions[16];
+   double max[16];
+   uint16_t known;
+   uint64_t evictions; /* of the table at the last publish(..) */
+
+   void write();
+
+   bool refresh(const QStore& table, int state);
+
+public:
+
+   PublishedPolicy();
+
+   void publish(const QStore& table);
+
+   void update(const QStore& table, FeetState state, uint64_t action, double qvalue);
+
+   void read(GreedyPolicy& policy) const;
+
+   uint64_t getVersion() const;
+
+};
+
+#endif
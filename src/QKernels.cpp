@@ -0,0 +1,222 @@
+#include "QKernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+   #include <immintrin.h>
+   #define QKERNELS_X86
+#endif
+
+/*
+ * The vector versions take two passes: max-reduction first, then the first position holding the max. Both passes stream the
+ * column sequentially and the second one usually stops early.
+*/
+
+static long argmaxScalar(const qvalue_t* values, size_t n)
+{
+   if(n == 0)
+      return -1;
+   size_t maxidx = 0;
+   for(size_t pos = 1; pos < n; pos++)
+   {
+      if(values[pos] > values[maxidx])
+         maxidx = pos;
+   }
+   return maxidx;
+}
+
+#ifdef QKERNELS_X86
+
+#ifndef QVALUE_FIXED16
+
+__attribute__((target("avx2")))
+static long argmaxAVX2(const qvalue_t* values, size_t n)
+{
+   if(n < 16)
+      return argmaxScalar(values, n);
+   __m256 max0 = _mm256_loadu_ps(values);
+   __m256 max1 = _mm256_loadu_ps(values + 8);
+   size_t pos = 16;
+   for(; pos + 16 <= n; pos += 16)
+   {
+      max0 = _mm256_max_ps(max0, _mm256_loadu_ps(values + pos));
+      max1 = _mm256_max_ps(max1, _mm256_loadu_ps(values + pos + 8));
+   }
+   max0 = _mm256_max_ps(max0, max1);
+   __m128 half = _mm_max_ps(_mm256_castps256_ps128(max0), _mm256_extractf128_ps(max0, 1));
+   half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+   half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+   float max = _mm_cvtss_f32(half);
+   for(; pos < n; pos++)
+      if(values[pos] > max)
+         max = values[pos];
+
+   __m256 target = _mm256_set1_ps(max);
+   for(pos = 0; pos + 8 <= n; pos += 8)
+   {
+      int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(values + pos), target, _CMP_EQ_OQ));
+      if(mask)
+         return pos + __builtin_ctz(mask);
+   }
+   for(; pos < n; pos++)
+      if(values[pos] == max)
+         return pos;
+   return -1;
+}
+
+__attribute__((target("sse2")))
+static long argmaxSSE(const qvalue_t* values, size_t n)
+{
+   if(n < 8)
+      return argmaxScalar(values, n);
+   __m128 max0 = _mm_loadu_ps(values);
+   __m128 max1 = _mm_loadu_ps(values + 4);
+   size_t pos = 8;
+   for(; pos + 8 <= n; pos += 8)
+   {
+      max0 = _mm_max_ps(max0, _mm_loadu_ps(values + pos));
+      max1 = _mm_max_ps(max1, _mm_loadu_ps(values + pos + 4));
+   }
+   max0 = _mm_max_ps(max0, max1);
+   max0 = _mm_max_ps(max0, _mm_movehl_ps(max0, max0));
+   max0 = _mm_max_ss(max0, _mm_shuffle_ps(max0, max0, 1));
+   float max = _mm_cvtss_f32(max0);
+   for(; pos < n; pos++)
+      if(values[pos] > max)
+         max = values[pos];
+
+   __m128 target = _mm_set1_ps(max);
+   for(pos = 0; pos + 4 <= n; pos += 4)
+   {
+      int mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(values + pos), target));
+      if(mask)
+         return pos + __builtin_ctz(mask);
+   }
+   for(; pos < n; pos++)
+      if(values[pos] == max)
+         return pos;
+   return -1;
+}
+
+#else /* QVALUE_FIXED16 */
+
+__attribute__((target("avx2")))
+static long argmaxAVX2(const qvalue_t* values, size_t n)
+{
+   if(n < 32)
+      return argmaxScalar(values, n);
+   __m256i max0 = _mm256_loadu_si256((const __m256i*) values);
+   __m256i max1 = _mm256_loadu_si256((const __m256i*) (values + 16));
+   size_t pos = 32;
+   for(; pos + 32 <= n; pos += 32)
+   {
+      max0 = _mm256_max_epi16(max0, _mm256_loadu_si256((const __m256i*) (values + pos)));
+      max1 = _mm256_max_epi16(max1, _mm256_loadu_si256((const __m256i*) (values + pos + 16)));
+   }
+   max0 = _mm256_max_epi16(max0, max1);
+   __m128i half = _mm_max_epi16(_mm256_castsi256_si128(max0), _mm256_extracti128_si256(max0, 1));
+   half = _mm_max_epi16(half, _mm_srli_si128(half, 8));
+   half = _mm_max_epi16(half, _mm_srli_si128(half, 4));
+   half = _mm_max_epi16(half, _mm_srli_si128(half, 2));
+   qvalue_t max = (qvalue_t) _mm_extract_epi16(half, 0);
+   for(; pos < n; pos++)
+      if(values[pos] > max)
+         max = values[pos];
+
+   __m256i target = _mm256_set1_epi16(max);
+   for(pos = 0; pos + 16 <= n; pos += 16)
+   {
+      int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (values + pos)), target));
+      if(mask)
+         return pos + (__builtin_ctz(mask) / 2);
+   }
+   for(; pos < n; pos++)
+      if(values[pos] == max)
+         return pos;
+   return -1;
+}
+
+__attribute__((target("sse2")))
+static long argmaxSSE(const qvalue_t* values, size_t n)
+{
+   if(n < 16)
+      return argmaxScalar(values, n);
+   __m128i max0 = _mm_loadu_si128((const __m128i*) values);
+   __m128i max1 = _mm_loadu_si128((const __m128i*) (values + 8));
+   size_t pos = 16;
+   for(; pos + 16 <= n; pos += 16)
+   {
+      max0 = _mm_max_epi16(max0, _mm_loadu_si128((const __m128i*) (values + pos)));
+      max1 = _mm_max_epi16(max1, _mm_loadu_si128((const __m128i*) (values + pos + 8)));
+   }
+   max0 = _mm_max_epi16(max0, max1);
+   max0 = _mm_max_epi16(max0, _mm_srli_si128(max0, 8));
+   max0 = _mm_max_epi16(max0, _mm_srli_si128(max0, 4));
+   max0 = _mm_max_epi16(max0, _mm_srli_si128(max0, 2));
+   qvalue_t max = (qvalue_t) _mm_extract_epi16(max0, 0);
+   for(; pos < n; pos++)
+      if(values[pos] > max)
+         max = values[pos];
+
+   __m128i target = _mm_set1_epi16(max);
+   for(pos = 0; pos + 8 <= n; pos += 8)
+   {
+      int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) (values + pos)), target));
+      if(mask)
+         return pos + (__builtin_ctz(mask) / 2);
+   }
+   for(; pos < n; pos++)
+      if(values[pos] == max)
+         return pos;
+   return -1;
+}
+
+#endif /* QVALUE_FIXED16 */
+
+#endif /* QKERNELS_X86 */
+
+typedef long (*ArgmaxKernel)(const qvalue_t*, size_t);
+
+struct KernelChoice
+{
+   ArgmaxKernel argmax;
+   const char* name;
+};
+
+static KernelChoice pickKernel()
+{
+   KernelChoice choice;
+   choice.argmax = argmaxScalar;
+   choice.name = "scalar";
+#ifdef QKERNELS_X86
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+   {
+      choice.argmax = argmaxAVX2;
+      choice.name = "avx2";
+   }
+   else if(__builtin_cpu_supports("sse2"))
+   {
+      choice.argmax = argmaxSSE;
+      choice.name = "sse";
+   }
+#endif
+   return choice;
+}
+
+/*
+ * Resolved once, on first use.
+*/
+static const KernelChoice& getKernel()
+{
+   static const KernelChoice choice = pickKernel();
+   return choice;
+}
+
+long argmaxQValues(const qvalue_t* values, size_t n)
+{
+   return getKernel().argmax(values, n);
+}
+
+const char* getQKernelName()
+{
+   return getKernel().name;
+}
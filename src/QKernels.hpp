@@ -0,0 +1,21 @@
+#ifndef _QKERNELS_
+#define _QKERNELS_
+
+#include "QStore.hpp"
+
+/*
+ * Max-reduction/argmax over a contiguous q-value column (see QStore::getQValues(..)). The AVX2/SSE versions are picked at
+ * runtime depending on the CPU, with a scalar fallback for everything else.
+*/
+
+/*
+ * Position of the first max value, -1 for an empty column.
+*/
+long argmaxQValues(const qvalue_t* values, size_t n);
+
+/*
+ * Name of the kernel picked for this CPU ("avx2", "sse" or "scalar").
+*/
+const char* getQKernelName();
+
+#endif
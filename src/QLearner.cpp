@@ -1,10 +1,18 @@
 #include "QLearner.hpp"
+#include "PerfCounters.hpp"
+#include "SortedQTable.hpp"
+#include "SharedQTable.hpp"
+#include <errno.h>
 
-QLearner::QLearner() {}
+QLearner::QLearner(): fallthreshold(1), currentQ(NULL), updates(0)
+{
+   hit = false;
+   down = false;
+}
 
 QLearner::QLearner(float epsilon, float alpha, 
                    float gamma, float tsprate): epsilon(epsilon), alpha(alpha),
-               	   gamma(gamma), tsprate(tsprate), currentQ(NULL)
+               	   gamma(gamma), tsprate(tsprate), fallthreshold(1), currentQ(NULL), updates(0)
 {
    hit = false;  /* assume that robot is not hit just at the start TODO: make this assumption dynamic + realistic */
    down = false; /* assume that robot is not down just at the start TODO: make this assumption dynamic + realistic */
@@ -23,6 +31,20 @@ void QLearner::init(float epsilon, float alpha, float gamma, float tsprate, unsi
    this->tsprate       = tsprate;
    this->fallthreshold = fallthreshold;
    this->myTime        = myTime;
+   falldetector.reset(fallthreshold, 0);
+}
+
+void QLearner::init(const LearnerParams& params, double myTime)
+{
+   init(params.epsilon, params.alpha, params.gamma, params.tsprate, params.fallthreshold, myTime);
+}
+
+/*
+ * Seed the exploration (agents are seeded with a fixed default seed).
+*/
+void QLearner::seed(uint64_t seed)
+{
+   rng.seed(seed);
 }
 
 /*
@@ -33,16 +55,13 @@ void QLearner::init(float epsilon, float alpha, float gamma, float tsprate, unsi
 
 double QLearner::getQValue(const State& state, const Action& action)
 {
+   PerfScope perf(PERF_GET_QVALUE);
    // search '<State, Action> Q' and return the 'Q' value for that state, if not found return 0
 
    // Searching for 'Q' value of an action 'a' in state 's'
-   std::vector<QTable>::iterator iter;
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
-   {
-      if(isStateSeen(iter->state_action_pair, state, action)) {
-         return iter->qvalue;
-      }
-   }
+   double qvalue;
+   if(Q.find(state.feet_state, action.getKey(), qvalue))
+      return qvalue;
    // State-Action does not exist in the Q-Table, so add it
    insertStateActionPair(state, action);
    return 0;
@@ -53,15 +72,12 @@ double QLearner::getQValue(const State& state, const Action& action)
 */
 bool QLearner::updateQValue(const State& state, const Action& action, double qvalue)
 {
-   std::vector<QTable>::iterator iter;
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
-   {
-      if(isStateSeen(iter->state_action_pair, state, action)) {
-         iter->qvalue = qvalue;
-         return true;
-      }
-   }
-   return false;
+   uint64_t key = action.getKey();
+   if(!Q.update(state.feet_state, key, qvalue))
+      return false;
+   if(published)
+      published->update(Q, state.feet_state, key, qvalue);
+   return true;
 }
 
 /*
@@ -72,26 +88,11 @@ bool QLearner::updateQValue(const State& state, const Action& action, double qva
 */
 double QLearner::getValue(const State& state)
 {
-   std::vector<Action> actionlist = getTriedActions(state);
-   std::vector<Action>::iterator iter;
-   std::vector<double> qvalues;
-   for(iter = actionlist.begin() ; iter < actionlist.end() ; ++iter)
-   {
-      qvalues.push_back(getQValue(state, *iter));
-   }
-
-   // Got the 'q-values' for all the actions, now find the max q-val
-   std::vector<double>::iterator iterd; //iterator double :D
-   double max = -DBL_MAX;
-   for(iterd = qvalues.begin() ; iterd < qvalues.end() ; ++iterd)
-   {
-      if(*iterd > max)
-      {
-         max = *iterd;
-      }
-   }
-   
-   return max;
+   // Max over the contiguous 'q-values' of the tried actions, see QKernels.hpp
+   long maxidx = Q.argmax(state.feet_state);
+   if(maxidx < 0)
+      return -DBL_MAX;
+   return Q.getQValue(state.feet_state, maxidx);
 }
 
 /*
@@ -99,34 +100,14 @@ double QLearner::getValue(const State& state)
 */
 Action QLearner::getPolicy(const State& state)
 {
-   std::vector<Action> actionlist = getTriedActions(state);
-   std::vector<Action>::iterator iter;
-   std::vector<double> qvalues;
-
-   for(iter = actionlist.begin() ; iter < actionlist.end() ; ++iter)
-   {
-      qvalues.push_back(getQValue(state, *iter));
-   }
-
    /*
-    * Got the 'q-values' for all the actions, now find the max q-val and then return action for that q-val.
+    * Find the max q-val among the tried actions and then return action for that q-val, only that action gets unpacked.
    */
-
-   std::vector<double>::iterator iterd;
-   double max = -DBL_MAX;
-   int idx = 0;
-   int maxidx = 0;
-   for(iterd = qvalues.begin() ; iterd < qvalues.end() ; ++iterd)
-   {
-      if(*iterd > max)
-      {
-         max = *iterd;
-         maxidx = idx;
-      }
-      idx++;
-   }
-   
-   return actionlist[maxidx];
+   Action action = Action(); /* Nothing tried in this state yet, all 'Plateau' */
+   long maxidx = Q.argmax(state.feet_state);
+   if(maxidx >= 0)
+      action.setKey(Q.getKey(state.feet_state, maxidx));
+   return action;
 }
 
 /*
@@ -137,6 +118,7 @@ Action QLearner::getPolicy(const State& state)
 */
 Action QLearner::justPolicy(State& state)
 {
+   PerfScope perf(PERF_JUST_POLICY);
    std::vector<QTable>::iterator iter;
    for(iter = Policy.begin(); iter != Policy.end(); ++iter)
    {
@@ -173,21 +155,21 @@ Action QLearner::getAction(State& state)
     * If state is not 'seen' then do a random action with probability '1'.
    */
    float epsilon = this->epsilon;
-   if(!isStatePresent(Q, state))
+   if(!Q.hasState(state.feet_state))
       epsilon = 1.0f;
    Action action;
+   EpisodeArena::Scope scope(arena); /* frees the action list */
    if(flipCoin(epsilon))
    {
-      std::vector<Action> listofactions;
       /*
        * With 'tsprate' probability try 'type 2' solution as this is our base solution :), else try random stuff.
       */
-      if(flipCoin(tsprate))
-         listofactions = getLegalActions(state, 0); // type '0' :) //TODO: Try other types as well
-      else
-         listofactions = getLegalActions(state, randomLimit(0, 2));
+      unsigned int type = 0; // type '0' :) //TODO: Try other types as well
+      if(!flipCoin(tsprate))
+         type = randomLimit(0, 2);
+      std::pmr::vector<Action> listofactions = getLegalActions(state, type);
 
-      action = listofactions[randomLimit(0, listofactions.size())];
+      action = listofactions[randomLimit(0, listofactions.size() - 1)];
    }
    else
       action = getPolicy(state);
@@ -213,39 +195,142 @@ void QLearner::doAction(Action& action)
 */
 void QLearner::update(State& state, Action& action, State& nextstate, int reward)
 {
-   std::vector<Action> actionlist = getTriedActions(nextstate);
-   std::vector<Action>::iterator iter;
-   std::vector<double> qvalues;
+   PerfScope perf(PERF_UPDATE);
+   double sample = getSample(nextstate, reward);
+   
+   double valueupdate = ( (1.0 - alpha) * getQValue(state, action) ) + (alpha * sample);
+   updates++;
+   // update the 'q-value'
+   if(updateQValue(state, action, valueupdate))
+      LOG("Updated qvalue for state: %s , action: %s with qvalue: %f.\n", 
+          state.getName().c_str(), action.getName().c_str(), valueupdate);
+   else
+      LOG("'QLearner::update()': Failed to Update qvalue for state: %s , action: %s with qvalue: %f. State-Action pair not found in 'Q-Table'.\n", state.getName().c_str(), action.getName().c_str(), valueupdate);
+}
+
+/*
+ * The 'sample' update(..) moves Q(state,action) towards: reward + gamma * max_action Q(nextstate,action), or just the 
+ * reward if no action was tried in 'nextstate' yet.
+*/
+double QLearner::getSample(State& nextstate, int reward)
+{
    double sample;
-   for(iter = actionlist.begin() ; iter < actionlist.end() ; ++iter)
-   {
-      qvalues.push_back(getQValue(nextstate, *iter));
-   }
-   if(qvalues.size() == 0)
+   long maxidx = Q.argmax(nextstate.feet_state);
+   if(maxidx < 0)
       sample = reward;
    else
+      sample = reward + (gamma * Q.getQValue(nextstate.feet_state, maxidx));
+   return sample;
+}
+
+/*
+ * How far update(..) would move Q(state,action), used to prioritize planning updates (see DynaPlanner).
+*/
+double QLearner::getTDError(State& state, Action& action, State& nextstate, int reward)
+{
+   double qvalue = 0; /* what update(..) would insert the pair with, without inserting it */
+   Q.find(state.feet_state, action.getKey(), qvalue);
+   return getSample(nextstate, reward) - qvalue;
+}
+
+/*
+ * Same with getValue(nextstate) already known, e.g. for all the pairs leading to one state. False (and nothing inserted) if
+ * Q(state,action) is not in the 'Q' table.
+*/
+bool QLearner::getTDError(const State& state, const Action& action, double nextvalue, int reward, double& error)
+{
+   double qvalue;
+   if(!Q.find(state.feet_state, action.getKey(), qvalue))
+      return false;
+   double sample = nextvalue == -DBL_MAX ? reward : reward + (gamma * nextvalue);
+   error = sample - qvalue;
+   return true;
+}
+
+/*
+ * Same as calling update(..) for every transition in the order they appear in 'transitions', but the packed actions are 
+ * resolved once up front and the max 'q-value' of every state touched by the batch is kept up to date as the batch is 
+ * applied, instead of being recomputed from the 'Q' table for every transition.
+*/
+void QLearner::updateBatch(std::span<const Transition> transitions)
+{
+   const int nstates = 16;
+   bool touched[nstates] = {false};
+   double max[nstates];
+   EpisodeArena::Scope scope(arena); /* frees 'keys' */
+   std::pmr::vector<uint64_t> keys(transitions.size(), arena.get());
+
+   /*
+    * Max 'q-value' of a state, -DBL_MAX when nothing was tried in that state.
+   */
+   auto getMax = [this](int s) {
+      long pos = Q.argmax((FeetState) s);
+      return pos < 0 ? -DBL_MAX : Q.getQValue((FeetState) s, pos);
+   };
+
+   /*
+    * Step 1. Group the batch by FeetState and resolve the keys in one pass.
+   */
+   for(size_t t = 0; t < transitions.size(); t++)
    {
-      // For speed avoiding call to getValue() as half of compuatation is already performed in the above loop...
-      double max = -DBL_MAX;
-      std::vector<double>::iterator iterd;
-      for(iterd = qvalues.begin() ; iterd < qvalues.end() ; ++iterd)
+      touched[transitions[t].state.feet_state] = true;
+      touched[transitions[t].nextstate.feet_state] = true;
+      keys[t] = transitions[t].action.getKey();
+   }
+
+   /*
+    * Step 2. Max 'q-value' of the touched states, once per state.
+   */
+   for(int s = 0; s < nstates; s++)
+      max[s] = touched[s] ? getMax(s) : -DBL_MAX;
+
+   /*
+    * Step 3. Apply the transitions in order.
+   */
+   for(size_t t = 0; t < transitions.size(); t++)
+   {
+      const Transition& tr = transitions[t];
+      FeetState s = tr.state.feet_state;
+      FeetState ns = tr.nextstate.feet_state;
+      double sample;
+      if(Q.getStateSize(ns) == 0)
+         sample = tr.reward;
+      else
+         sample = tr.reward + (gamma * max[ns]);
+
+      double oldvalue;
+      if(!Q.find(s, keys[t], oldvalue))
       {
-         if(*iterd > max)
+         uint64_t evictions = Q.getEvictions();
+         if(!insertStateActionPair(tr.state, tr.action))
+            continue; /* dropped (full shared state), there is nothing to update */
+         oldvalue = 0.0;
+         if(Q.getEvictions() != evictions)
          {
-            max = *iterd;
+            /*
+             * A bounded table just dropped entries, the cached max values can be stale.
+            */
+            for(int m = 0; m < nstates; m++)
+               if(touched[m])
+                  max[m] = getMax(m);
          }
+         else if(0.0 > max[s])
+            max[s] = 0.0;
       }
-      sample = reward + (gamma * max);
+
+      double valueupdate = ( (1.0 - alpha) * oldvalue ) + (alpha * sample);
+      if(!Q.update(s, keys[t], valueupdate))
+         continue;
+      if(published)
+         published->update(Q, s, keys[t], valueupdate);
+      valueupdate = QStore::round(valueupdate); /* what the next lookup will see */
+      if(valueupdate >= max[s])
+         max[s] = valueupdate;
+      else if(oldvalue == max[s])
+         max[s] = getMax(s); /* The old max went down, find the new one. */
    }
-   
-   double *ptr = NULL;
-   double valueupdate = ( (1.0 - alpha) * getQValue(state, action) ) + (alpha * sample);
-   // update the 'q-value'
-   if(updateQValue(state, action, valueupdate))
-      LOG("Updated qvalue for state: %s , action: %s with qvalue: %f.\n", 
-          state.getName().c_str(), action.getName().c_str(), valueupdate);
-   else
-      LOG("'QLearner::update()': Failed to Update qvalue for state: %s , action: %s with qvalue: %f. State-Action pair not found in 'Q-Table'.\n", state.getName().c_str(), action.getName().c_str(), valueupdate);
+   updates += transitions.size();
+   LOG("Updated qvalues for a batch of %zu transitions.\n", transitions.size());
 }
 
 int QLearner::getReward()
@@ -292,26 +377,76 @@ bool QLearner::loadPolicy(const std::string filename)
 
 bool QLearner::savePolicy(const std::string filename)
 {
-   std::vector<QTable> policyQ = getCurrentPolicy();
-   std::vector<QTable>::iterator iter;
+   return writePolicy(Q, filename);
+}
+
+/*
+ * Saves the 'policy' of any 'Q' table, e.g. of a snapshot(), in the format of savePolicy(..).
+*/
+bool QLearner::writePolicy(const QStore& table, const std::string filename)
+{
+   std::string data;
+   formatPolicy(table, data);
+   return writeFile(filename, data);
+}
+
+/*
+ * Saves a 'policy' computed elsewhere (one entry per state, see getCurrentPolicy(..)) in the format of savePolicy(..).
+*/
+bool QLearner::writePolicy(const std::vector<QTable>& policy, const std::string filename)
+{
+   std::string data;
+   formatPolicy(policy, data);
+   return writeFile(filename, data);
+}
+
+/*
+ * FeetState Q-value action1,action2... \n
+*/
+static void formatEntry(const QTable& entry, std::string& out)
+{
+   char line[256];
+   int length = snprintf(line, sizeof(line), "%i %f ", entry.state_action_pair.state.feet_state, entry.qvalue);
+   for(unsigned int i = 0; i < 24; i++)
+      length += snprintf(line + length, sizeof(line) - length, "%i ", entry.state_action_pair.action.rs_neuron_pattern.rsneuron[i].pattern);
+   line[length++] = '\n';
+   out.append(line, length);
+}
+
+/*
+ * Appends the file content savePolicy(..) would write for 'table' to 'out', e.g. for AsyncWriter.
+*/
+void QLearner::formatPolicy(const QStore& table, std::string& out)
+{
+   formatPolicy(getCurrentPolicy(table), out);
+}
+
+void QLearner::formatPolicy(const std::vector<QTable>& policy, std::string& out)
+{
+   for(size_t i = 0; i < policy.size(); i++)
+      formatEntry(policy[i], out);
+}
+
+/*
+ * Appends the file content saveQTable(..) would write for 'table' to 'out'.
+*/
+void QLearner::formatQTable(const QStore& table, std::string& out)
+{
+   for(int s = 0; s < 16; s++)
+   {
+      for(size_t pos = 0; pos < table.getStateSize((FeetState) s); pos++)
+         formatEntry(table.getEntry((FeetState) s, pos), out);
+   }
+}
+
+bool QLearner::writeFile(const std::string& filename, const std::string& data)
+{
    FILE* file= NULL;
    file = fopen(filename.c_str(),"w");
    if(!file)
       return false;
-   for(iter = policyQ.begin(); iter != policyQ.end(); ++iter)
-   {
-      /*
-       * FeetState Q-value action1,action2... \n
-       */
-      fprintf(file,"%i %f ",iter->state_action_pair.state.feet_state, iter->qvalue);
-      for(unsigned int i = 0; i < 24; i++)
-      {
-         fprintf(file, "%i ",iter->state_action_pair.action.rs_neuron_pattern.rsneuron[i].pattern);
-      }
-      fprintf(file,"\n");
-   }
-   fclose(file);
-   return true;
+   bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+   return (fclose(file) == 0) && ok;
 }
 
 /*
@@ -353,11 +488,15 @@ void QLearner::printPersistentPolicy()
 
 bool QLearner::loadQTable(const std::string filename)
 {
+   PerfScope perf(PERF_LOAD_QTABLE);
    LOG("QLearner::loadQTable()\n");
    std::ifstream file(filename.c_str());
    if(!file)
       return false;
    std::string line;
+   double maxerror = 0.0; /* q-value lost to the quantization, see QStore.hpp */
+   double sumerror = 0.0;
+   size_t loaded = 0;
    /*
     * FeetState Q-value action1,action2... \n
     */
@@ -375,36 +514,188 @@ bool QLearner::loadQTable(const std::string filename)
       qtab.state_action_pair.state.feet_state = getFeetState(state);
       for(int i = 2; i != tvalues.size(); i++)
            qtab.state_action_pair.action.rs_neuron_pattern.rsneuron[i-2].pattern = getPattern(tvalues[i]);
-      Q.push_back(qtab);
+      double error = fabs(qtab.qvalue - QStore::round(qtab.qvalue));
+      sumerror += error;
+      if(error > maxerror)
+         maxerror = error;
+      loaded++;
+      /*
+       * Only the first entry of a <state, action> pair was ever used, drop the duplicates.
+      */
+      double qvalue;
+      uint64_t key = qtab.state_action_pair.action.getKey();
+      if(!Q.find(qtab.state_action_pair.state.feet_state, key, qvalue))
+         Q.insert(qtab.state_action_pair.state.feet_state, key, qtab.qvalue);
    }
       LOG("Size QTable: %zu\n", Q.size());
+      LOG("Q-value quantization error: max %g, mean %g\n", maxerror, loaded ? sumerror / loaded : 0.0);
       file.close();
       return true;
 }
 
 bool QLearner::saveQTable(const std::string filename)
 {
-   std::vector<QTable>::iterator iter;
-   FILE* file= NULL;
-   file = fopen(filename.c_str(),"w");
-   if(!file)
+   return writeQTable(Q, filename);
+}
+
+/*
+ * Keep the 'Q' table in the slot file 'filename' instead (see SlotFile): loads it (or creates it), from then on
+ * checkpointSlots(..) only writes the entries that changed.
+*/
+bool QLearner::openSlotFile(const std::string filename)
+{
+   PerfScope perf(PERF_LOAD_QTABLE);
+   LOG("QLearner::openSlotFile()\n");
+   Q.clear();
+   slotfile.reset(new SlotFile());
+   if(slotfile->open(filename, Q))
+   {
+      LOG("Size QTable: %zu\n", Q.size());
+      return true;
+   }
+   slotfile.reset();
+   return false;
+}
+
+/*
+ * Writes the changes of the 'Q' table since the last checkpoint to the slot file, fdatasyncs if 'sync'.
+*/
+bool QLearner::checkpointSlots(bool sync)
+{
+   return slotfile && slotfile->checkpoint(Q, sync);
+}
+
+/*
+ * NULL unless openSlotFile(..) was used.
+*/
+const SlotFile* QLearner::getSlotFile() const
+{
+   return slotfile.get();
+}
+
+/*
+ * Use the sorted 'Q' table file 'filename' (see SortedQTable) without reading it: a state's entries are loaded when the
+ * state is first visited. A missing file starts an empty table.
+*/
+bool QLearner::openSortedQTable(const std::string filename)
+{
+   PerfScope perf(PERF_LOAD_QTABLE);
+   LOG("QLearner::openSortedQTable()\n");
+   std::shared_ptr<SortedQTable> file = std::make_shared<SortedQTable>();
+   if(!file->open(filename))
+   {
+      if(errno != ENOENT)
+         return false;
+      Q.clear();
+      return true;
+   }
+   Q.attach(file);
+   LOG("Size QTable: %zu\n", Q.size());
+   return true;
+}
+
+/*
+ * Saves the 'Q' table as a sorted file, replacing 'filename' atomically (even while it is the file being used).
+*/
+bool QLearner::saveSortedQTable(const std::string filename)
+{
+   return SortedQTable::write(Q, filename);
+}
+
+/*
+ * Work on the 'Q' table in the shared memory object 'name' (see SharedQTable) together with the other processes attached
+ * to it. The process creating it (with 'capacity' entries per state) fills it from the 'q-table' file 'filename' if there
+ * is one, the others attach without loading anything.
+*/
+bool QLearner::shareQTable(const std::string name, uint32_t capacity, const std::string filename)
+{
+   LOG("QLearner::shareQTable()\n");
+   std::shared_ptr<SharedQTable> table = std::make_shared<SharedQTable>();
+   if(!table->open(name, capacity))
       return false;
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
+   Q.share(table);
+   if(table->isCreator())
    {
-      /*
-       * FeetState Q-value action1,action2... \n
-       */
-      fprintf(file,"%i %f ",iter->state_action_pair.state.feet_state, iter->qvalue);
-      for(unsigned int i = 0; i < 24; i++)
-      {
-         fprintf(file, "%i ",iter->state_action_pair.action.rs_neuron_pattern.rsneuron[i].pattern);
-      }
-      fprintf(file,"\n");
+      loadQTable(filename);
+      table->setReady(); /* only now the others attach, see SharedQTable::open(..) */
    }
-   fclose(file);
+   LOG("Size QTable: %zu (%u processes attached)\n", Q.size(), table->getAttached());
    return true;
 }
 
+/*
+ * NULL unless shareQTable(..) was used.
+*/
+const SharedQTable* QLearner::getSharedQTable() const
+{
+   return Q.getShared();
+}
+
+/*
+ * Average the 'Q' table with the other learner processes connected to the AggregationServer at 'path', see
+ * syncAggregator().
+*/
+bool QLearner::connectAggregator(const std::string path)
+{
+   LOG("QLearner::connectAggregator()\n");
+   aggregator.reset(new AggregationClient());
+   if(aggregator->connect(path, Q))
+      return true;
+   aggregator.reset();
+   return false;
+}
+
+/*
+ * Sends the changes since the last sync & takes over the merged 'q-values', false if the service went away (the table is
+ * kept as it is).
+*/
+bool QLearner::syncAggregator()
+{
+   bool synced = aggregator && aggregator->sync(Q);
+   if(synced && published)
+      published->publish(Q);
+   return synced;
+}
+
+/*
+ * NULL unless connectAggregator(..) was used.
+*/
+const AggregationClient* QLearner::getAggregator() const
+{
+   return aggregator.get();
+}
+
+/*
+ * Starts (or refreshes) publishing the greedy policy of the 'Q' table for a control thread, see PublishedPolicy: from then
+ * on every update that changes the argmax of a state republishes it. Call it from the learning thread, after loading.
+ * Changes made by other processes to a shared table only show up with the next call or the next local change of the state.
+*/
+const PublishedPolicy& QLearner::publishPolicy()
+{
+   if(!published)
+      published.reset(new PublishedPolicy());
+   published->publish(Q);
+   return *published;
+}
+
+/*
+ * NULL unless publishPolicy() was called.
+*/
+const PublishedPolicy* QLearner::getPublishedPolicy() const
+{
+   return published.get();
+}
+
+/*
+ * Saves any 'Q' table, e.g. a snapshot() taken while training goes on in another thread, in the format of saveQTable(..).
+*/
+bool QLearner::writeQTable(const QStore& table, const std::string filename)
+{
+   std::string data;
+   formatQTable(table, data);
+   return writeFile(filename, data);
+}
+
 /*
  * Print the whole 'Q' table.
 */
@@ -412,14 +703,17 @@ bool QLearner::saveQTable(const std::string filename)
 void QLearner::printQTable()
 {
    LOG("QLearner::printQTable()\n");
-   std::vector<QTable>::iterator iter;
    LOG("# of elements in QTable : %zu\n", Q.size());
    LOG("\nState\n  * Action\n    -> Q-value\n\n");
    int count = 1;
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
+   for(int s = 0; s < 16; s++)
    {
-      LOG("%i.\n%s\n *  %s\n  ->  %lf\n\n", count, iter->state_action_pair.state.getName().c_str(), iter->state_action_pair.action.getName().c_str(), iter->qvalue);
-      count++;
+      for(size_t pos = 0; pos < Q.getStateSize((FeetState) s); pos++)
+      {
+         QTable entry = Q.getEntry((FeetState) s, pos);
+         LOG("%i.\n%s\n *  %s\n  ->  %lf\n\n", count, entry.state_action_pair.state.getName().c_str(), entry.state_action_pair.action.getName().c_str(), entry.qvalue);
+         count++;
+      }
    }
 }
 
@@ -443,55 +737,18 @@ bool QLearner::createPersistence(const std::string qtablePath, const std::string
    return true;
 }
 
-/*
- * Returns true is state already seen by 'Q' datastructure :)
- */
-bool QLearner::isStateSeen(const StateActionPair& s_a_pair, const State& state, 
- 			const Action& action) const
-{
-   // Step 1. Compare the foot states
-   if(s_a_pair.state.compareFeetState(state.feet_state))
-   {
-      // Step 2. Compare the point of impact.TODO: Right now no way of getting 'point of impact'.
-      // Step 3. Now compare the actions
-      if(s_a_pair.action.compareActions(action))
-         return true;
-   }
-
-   return false;
-}
-
-/*
- * Get all the already 'tried' actions i.e the ones stored in Q-table.
-*/
-std::vector<Action> QLearner::getTriedActions(const State& state) const
-{
-   std::vector<Action> actionlist;
-   std::vector<QTable>::const_iterator iter;
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
-   {
-      if(iter->state_action_pair.state.compareFeetState(state.feet_state))
-      {
-         actionlist.push_back(iter->state_action_pair.action);
-      }
-   }
-   //TODO: @warn: remove this code
-   FeetState fstate = state.feet_state;
-   LOG("Size [TriedActions]: %zu for State: %s\n", actionlist.size(), State::getName(fstate).c_str());
-   return actionlist;
-}
-
 /*
  * Get all the legal actions for a state [in our case, all states have same legal actions], first return the actions which were already
  * tried before and for whom we already have a Q-value.
 */
-std::vector<Action> QLearner::getLegalActions(const State& state, unsigned int type) const
+std::pmr::vector<Action> QLearner::getLegalActions(const State& state, unsigned int type)
 {
    LOG("getLegalActions().. -- type : %i\n", type);
    unsigned int min_val = 0;
    unsigned int max_val = 5;
    unsigned int num_actions = 10;
-   std::vector<Action> actionlist;
+   std::pmr::vector<Action> actionlist(arena.get());
+   actionlist.reserve(num_actions);
    Action action;
    /*
     * Now also get few new actions which could help us.
@@ -557,36 +814,34 @@ std::vector<Action> QLearner::getLegalActions(const State& state, unsigned int t
 
 /*
  * Use for selecting an action with probability 'p'
- * TODO: Use better version of random generation, sth like 'std::uniform_real_distribution'
- * @imp: Candidate for improvement.
 */
 
 bool QLearner::flipCoin(double p)
 {
-   double r = ((double) rand() / (RAND_MAX));
+   double r = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
    
    return r < p;
 }
 
 /*
  * Generate random number in between the limit (boundry values included).
- * TODO: Use better version of random generation, sth like 'std::uniform_real_distribution'
- * @imp: Candidate for improvement.
 */
 
 int QLearner::randomLimit(unsigned int min, unsigned int max) const
 {
-   return (min + (rand() % (int)(max - min + 1)));
+   return std::uniform_int_distribution<int>(min, max)(rng);
 }
 
+/*
+ * False if the pair could not be added (a full state of a shared table).
+*/
 bool QLearner::insertStateActionPair(const State& state, const Action& action)
 {
-   QTable q;
-   q.state_action_pair.state = state;
-   q.state_action_pair.action = action;
-   q.qvalue = 0.0; // for the new experienced state, 'q-value' is 0
-   Q.push_back(q);
-   return false;
+   if(!Q.insert(state.feet_state, action.getKey(), 0.0)) // for the new experienced state, 'q-value' is 0
+      return false;
+   if(published)
+      published->update(Q, state.feet_state, action.getKey(), 0.0);
+   return true;
 }
 
 /*
@@ -604,102 +859,61 @@ FeetState QLearner::determineState(double lfrontL, double lfrontR, double rfront
    FeetState fstate;
    if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = ZERO_FSRS;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = R_BACK;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_BACK;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = R_FRONT;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = R_FRONT_BACK;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_BACK_R_FRONT;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK_R_FRONT;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = L_FRONT;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = L_FRONT_R_BACK;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_FRONT_BACK;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK_L_FRONT;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = L_R_FRONT;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = L_R_FRONT_R_BACK;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_R_FRONT_L_BACK;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = ALL_FSRS;
    return fstate;
 }
 
 /*
- * Used by print/load/save policy to the identify the unique states.
-*/
-
-bool QLearner::isStatePresent(std::vector<QTable>& q, const State& state) const
-{
-   std::vector<QTable>::iterator iter;
-   for(iter = q.begin(); iter != q.end(); ++iter)
-   {
-      if(iter->state_action_pair.state.compareFeetState(state.feet_state))
-         return true;
-   }
-   return false;
-}
-
-/*
- * Used by print/load/save policy to the get the index of unique states.
+ * This method is needed by printPolicy() & savePolicy() to get the unique 'policy' for each state.
 */
 
-int QLearner::getStateIndex(std::vector<QTable>& q, const State& state) const
+std::vector<QTable> QLearner::getCurrentPolicy() const
 {
-   std::vector<QTable>::iterator iter;
-   int idx = 0;
-   for(iter = q.begin(); iter != q.end(); ++iter)
-   {
-      if(iter->state_action_pair.state.compareFeetState(state.feet_state))
-         return idx;
-      idx++;
-   }
-
-   return -1;
-
+   return getCurrentPolicy(Q);
 }
 
-/*
- * This method is needed by printPolicy() & savePolicy() to get the unique 'policy' for each state.
-*/
-
-std::vector<QTable> QLearner::getCurrentPolicy() const
+std::vector<QTable> QLearner::getCurrentPolicy(const QStore& table)
 {
+   PerfScope perf(PERF_CURRENT_POLICY);
    // Get max action for all the states.
-   std::vector<QTable>::const_iterator iter;
    std::vector<QTable> policyQ;
-   /*
-    * Get unique states.
-   */
-   for(iter = Q.begin(); iter != Q.end(); ++iter)
+   for(int s = 0; s < 16; s++)
    {
-      if(!(isStatePresent(policyQ, iter->state_action_pair.state)))
-         policyQ.push_back(*iter);
-      else
-      {
-         /*
-          * If the 'q-value' of that state for another action is '>' than our q-value, then erase the previous action and add this one.
-         */
-         int idx = getStateIndex(policyQ, iter->state_action_pair.state);
-         if(policyQ.at(idx).qvalue < iter->qvalue)
-         {
-            policyQ.erase(policyQ.begin() + idx);
-            policyQ.push_back(*iter);
-         }
-            
-      } 
+      /*
+       * Only the q-value column is scanned, the action is unpacked for the winner alone.
+      */
+      long maxidx = table.argmax((FeetState) s);
+      if(maxidx >= 0)
+         policyQ.push_back(table.getEntry((FeetState) s, maxidx));
    }
    return policyQ;
 }
@@ -886,8 +1100,7 @@ void QLearner::getTSP(Action& act1) const
 }
 
 /*
- * Right now the only way to detect perturbation is via 'time'. 
- * TODO: Try to get perturbation detection with accelerometer data.
+ * Perturbation detection via 'time', see the ImuSample overload for detection on accelerometer/gyro data.
  * @imp: Candidate for improvement.
 */
 
@@ -901,32 +1114,47 @@ bool QLearner::detectPerturbation(double myTime)
 }
 
 /*
- * Take the FeetState and start the counter of 'fallindex'.
+ * Streaming perturbation detection on the IMU data, see ImpactDetector. Once a perturbation is detected the agent stays
+ * 'hit' for the rest of the episode.
+*/
+bool QLearner::detectPerturbation(const ImuSample& sample)
+{
+   if(impactdetector.push(sample))
+      hit = true;
+   return hit;
+}
+
+void QLearner::configureImpactDetector(unsigned int window, double threshold, double gyroweight)
+{
+   impactdetector.configure(window, threshold, gyroweight);
+}
+
+/*
+ * Start watching for a fall over the next 'window' FeetState samples (0 = until a fall), see FallDetector.
+*/
+void QLearner::watchFall(unsigned int window)
+{
+   falldetector.reset(fallthreshold, window);
+}
+
+/*
+ * Feed the next FeetState of the watch window, true once 'fallthreshold' consecutive samples had no foot on the ground.
  * TODO: Find a better way to detect 'robot fall'. 
  * @imp: Candidate for improvement.
 */
 bool QLearner::detectFall(FeetState fstate)
 {
-   switch(fstate)
-   {
-      case 0:
-         fallcount++;
-         break;
-      default:
-         fallcount = -1;
-         break;
-   }
-
-   if(fallcount == -1)
-      return false;
-
-   else if(fallcount < fallthreshold)//TODO: adjust the threshold for 'fallcount'
-      return false;
-  
-   else
+   if(falldetector.push(fstate) == FALL_FELL)
       down = true;
-   return true; 
+   return down;
+}
 
+/*
+ * True as soon as the watch window can't change the outcome anymore (fell, or too few samples left to fall).
+*/
+bool QLearner::isFallDecided() const
+{
+   return falldetector.getOutcome() != FALL_UNDECIDED;
 }
 
 bool QLearner::getHit()
@@ -939,4 +1167,68 @@ bool QLearner::getFall()
    return down;
 }
 
+/*
+ * Bound the 'Q' table to 'capacity' entries (0 = unbounded), see QStore.
+*/
+void QLearner::setCapacity(size_t capacity, EvictionPolicy policy)
+{
+   Q.setCapacity(capacity, policy);
+}
+
+/*
+ * Forget the perturbation/fall of the previous episode.
+*/
+void QLearner::resetEpisode()
+{
+   hit = false;
+   down = false;
+   falldetector.reset(fallthreshold, 0);
+   impactdetector.reset();
+}
+
+/*
+ * O(1) copy of the 'Q' table as it is now (see QStore), to branch off A/B runs or an evaluation (restore(..) it into another
+ * QLearner), to save it in the background (writeQTable(..)/writePolicy(..)) or to roll back to later.
+*/
+QStore QLearner::snapshot() const
+{
+   return Q.snapshot();
+}
+
+/*
+ * Continue from a snapshot(), the current 'Q' table is dropped. O(1) as well, the snapshot stays valid.
+ * Refused (false) while the table is tied to something outside the process: a slot file (whose slot assignment would no
+ * longer match the table), a shared table, an aggregation service or a sorted file (they would be dropped).
+*/
+bool QLearner::restore(const QStore& snapshot)
+{
+   if(slotfile || Q.getShared() || aggregator || Q.isAttached())
+   {
+      ERROR("Error in restoring the 'q-table': a slot file, shared table, aggregator or sorted file is attached\n");
+      return false;
+   }
+   Q = snapshot.snapshot();
+   if(published)
+      published->publish(Q);
+   return true;
+}
+
+unsigned long QLearner::getUpdateCount() const
+{
+   return updates;
+}
+
+size_t QLearner::getQTableSize() const
+{
+   return Q.size();
+}
+
+/*
+ * # of states loaded from the file of openSortedQTable(..) so far.
+*/
+unsigned int QLearner::getPagedStates() const
+{
+   return Q.getPagedStates();
+}
+
 QLearner::~QLearner() {}
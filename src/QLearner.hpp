@@ -3,11 +3,36 @@
 
 #include "core.hpp"
 #include "log.hpp"
+#include "QStore.hpp"
+#include "FallDetector.hpp"
+#include "ImpactDetector.hpp"
+#include "EpisodeArena.hpp"
+#include "SlotFile.hpp"
+#include "Aggregation.hpp"
+#include "PublishedPolicy.hpp"
 #include <float.h>
+#include <math.h>
 #include <stdlib.h>
 #include <time.h>
 #include <fstream>
 #include <sstream>
+#include <span>
+#include <unordered_map>
+#include <random>
+
+/*
+ * Hyperparameters of QLearner::init(..), the defaults are the ones used so far.
+ * TODO: Make sure that the values of epsilon, gamma are optimal (see SweepRunner). @Ref: (Paper) epsilon = 0.3, alpha = 0.1
+*/
+struct LearnerParams
+{
+   float epsilon;
+   float alpha;
+   float gamma;
+   float tsprate;
+   unsigned int fallthreshold;
+   LearnerParams(): epsilon(0.05f), alpha(0.8f), gamma(0.2f), tsprate(0.7f), fallthreshold(50) {}
+};
 
 /*
  * Agent that uses Q-learning with ...
@@ -16,7 +41,7 @@ class QLearner: public Agent
 {
 private:
 
-   std::vector<QTable> Q;
+   QStore Q;
 
    std::vector<QTable> Policy;
    
@@ -27,20 +52,26 @@ private:
    float tsprate; /* probability to try a particular TSP solution */
 
    double myTime; //TODO: temperary variable, time at which collision occurs
-   int fallcount;
    unsigned int fallthreshold;
+   FallDetector falldetector;
+   ImpactDetector impactdetector;
 
    bool hit; // true when external perturbation occurs. TODO: How to get this ??
    bool down; // true when robot falls on the ground. TODO: How to get this ??
 
    double *currentQ; // need to update 'Q-values' :)
 
-   bool isStateSeen(const StateActionPair& s_a_pair, const State& state, 
-			const Action& action) const;
+   unsigned long updates; // # of 'q-value' updates so far
+
+   EpisodeArena arena; // temporaries of getAction(..) & updateBatch(..), freed when they return
 
-   std::vector<Action> getTriedActions(const State& state) const;
+   mutable std::mt19937_64 rng; // per agent, so that agents can run in parallel & be reproduced from a seed
 
-   std::vector<Action> getLegalActions(const State& state, unsigned int type) const ;
+   std::unique_ptr<SlotFile> slotfile; // incremental persistence of the 'Q' table, see openSlotFile(..)
+   std::unique_ptr<AggregationClient> aggregator; // parameter averaging with other processes, see connectAggregator(..)
+   std::unique_ptr<PublishedPolicy> published; // greedy policy for a control thread, see publishPolicy()
+
+   std::pmr::vector<Action> getLegalActions(const State& state, unsigned int type);
 
    bool flipCoin (double p);
 
@@ -48,14 +79,10 @@ private:
 
    bool insertStateActionPair(const State& state, const Action& action);
 
-   FeetState determineState(double lfrontL, double lfrontR, double rfrontL, double rfrontR, double lbackL, double lbackR, double rbackL, double rbackR);
-
-   bool isStatePresent(std::vector<QTable>& q, const State& state) const;
-
-   int getStateIndex(std::vector<QTable>& q, const State& state) const;
-
    std::vector<QTable> getCurrentPolicy() const;
 
+   static std::vector<QTable> getCurrentPolicy(const QStore& table);
+
    Action getBaseActionTSP() const;
 
    Action getAllActionTSP() const;  
@@ -73,8 +100,12 @@ private:
 
    void getTSP(Action& act1) const;
 
+   double getSample(State& nextstate, int reward);
+
 public:
 
+   static const size_t MAX_BATCH = 4096; // transitions per updateBatch(..) whose temporaries fit in the arena, see EpisodeArena
+
    QLearner();
 
    QLearner(float epsilon, float alpha, 
@@ -83,6 +114,20 @@ public:
 
    void init(float epsilon, float alpha, float gamma, float tsprate, unsigned int fallthreshold, double myTime);
 
+   void init(const LearnerParams& params, double myTime);
+
+   void seed(uint64_t seed);
+
+   void setCapacity(size_t capacity, EvictionPolicy policy = EVICT_LOW_VALUE);
+
+   void resetEpisode();
+
+   unsigned long getUpdateCount() const;
+
+   size_t getQTableSize() const;
+
+   unsigned int getPagedStates() const;
+
    int getReward();
 
    double getQValue(const State& state, const Action& action);
@@ -101,6 +146,12 @@ public:
 
    void update(State& state, Action& action, State& nextstate, int reward);
 
+   void updateBatch(std::span<const Transition> transitions);
+
+   double getTDError(State& state, Action& action, State& nextstate, int reward);
+
+   bool getTDError(const State& state, const Action& action, double nextvalue, int reward, double& error);
+
    virtual ~QLearner();
 
    virtual bool savePolicy(const std::string filename);
@@ -115,13 +166,65 @@ public:
 
    bool saveQTable(const std::string filename);
 
+   bool openSlotFile(const std::string filename);
+
+   bool checkpointSlots(bool sync);
+
+   const SlotFile* getSlotFile() const;
+
+   bool openSortedQTable(const std::string filename);
+
+   bool saveSortedQTable(const std::string filename);
+
+   bool shareQTable(const std::string name, uint32_t capacity, const std::string filename);
+
+   const SharedQTable* getSharedQTable() const;
+
+   bool connectAggregator(const std::string path);
+
+   bool syncAggregator();
+
+   const AggregationClient* getAggregator() const;
+
+   const PublishedPolicy& publishPolicy();
+
+   const PublishedPolicy* getPublishedPolicy() const;
+
+   static bool writeQTable(const QStore& table, const std::string filename);
+
+   static bool writePolicy(const QStore& table, const std::string filename);
+
+   static bool writePolicy(const std::vector<QTable>& policy, const std::string filename);
+
+   static void formatQTable(const QStore& table, std::string& out);
+
+   static void formatPolicy(const QStore& table, std::string& out);
+
+   static void formatPolicy(const std::vector<QTable>& policy, std::string& out);
+
+   static bool writeFile(const std::string& filename, const std::string& data);
+
+   QStore snapshot() const;
+
+   bool restore(const QStore& snapshot);
+
    void printQTable();
 
    bool createPersistence(const std::string qtablePath, const std::string policyPath);
 
+   FeetState determineState(double lfrontL, double lfrontR, double rfrontL, double rfrontR, double lbackL, double lbackR, double rbackL, double rbackR);
+
    bool detectPerturbation(double myTime);
 
+   bool detectPerturbation(const ImuSample& sample);
+
+   void configureImpactDetector(unsigned int window, double threshold, double gyroweight);
+
+   void watchFall(unsigned int window);
+
    bool detectFall(FeetState fstate);
+
+   bool isFallDecided() const;
  
    bool getHit();
 
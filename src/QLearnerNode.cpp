@@ -1,25 +1,54 @@
 #include "QLearnerNode.hpp"
 
-QLearnerNode::QLearnerNode() { }
+QLearnerNode::QLearnerNode(): sharedCapacity(0) { }
 
 QLearnerNode::QLearnerNode(std::string qtablePath, 
                            std::string policyPath):qtablePath(qtablePath), 
-                           policyPath(policyPath)
+                           policyPath(policyPath), sharedCapacity(0)
 {
    /*
-    * QLearner(epsilon, alpha, gamma, tsprate, fallcount, myTime);
-    * TODO: Make sure that the values of epsilon, gamma are optimal. @Ref: (Paper) epsilon = 0.3, alpha = 0.1
+    * QLearner(epsilon, alpha, gamma, tsprate, fallcount, myTime), see LearnerParams for the defaults.
    */
-   agent.init(0.05f, 0.8f, 0.2f, 0.7f, 50, 9.04);
+   agent.init(LearnerParams(), 9.04);
+}
+
+/*
+ * Act on the 'q-table' the learner processes on this host share (see SharedQTable) instead of a copy loaded from
+ * 'qtablePath': what they learn shows up right away. Takes effect with the next initialize().
+*/
+void QLearnerNode::setSharedTable(const std::string& name, uint32_t capacity)
+{
+   sharedName = name;
+   sharedCapacity = capacity;
 }
 
 bool QLearnerNode::initialize()
 {
-   if(agent.loadQTable(qtablePath) && agent.loadPolicy(policyPath))
+   bool loaded = sharedName.empty() ? agent.loadQTable(qtablePath) : agent.shareQTable(sharedName, sharedCapacity, qtablePath);
+   agent.publishPolicy();
+   if(loaded && agent.loadPolicy(policyPath))
       return true;
    return false;
 }
 
+/*
+ * Greedy action for the control thread, while 'agent' goes on learning in another thread: reads the policy the agent
+ * publishes (see PublishedPolicy), without locks or waiting for the learner. All 'Plateau' for a state with nothing tried
+ * yet, like QLearner::getPolicy(..).
+*/
+Action QLearnerNode::getControlAction(const State& state) const
+{
+   Action action = Action();
+   const PublishedPolicy* published = agent.getPublishedPolicy(); /* set by initialize() */
+   if(!published)
+      return action;
+   GreedyPolicy policy;
+   published->read(policy);
+   if(policy.known & (1u << state.feet_state))
+      action.setKey(policy.actions[state.feet_state]);
+   return action;
+}
+
 bool QLearnerNode::initializer()
 {
    if(initialize())
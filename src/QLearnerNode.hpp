@@ -5,11 +5,15 @@ class QLearnerNode
 {
    std::string qtablePath;
    std::string policyPath;
+   std::string sharedName; /* see setSharedTable(..) */
+   uint32_t sharedCapacity;
 public:
    QLearner agent;
    QLearnerNode();
    QLearnerNode(std::string qtablePath, std::string policyPath);
    
+   void setSharedTable(const std::string& name, uint32_t capacity);
    bool initialize();
    bool initializer();
+   Action getControlAction(const State& state) const;
 };
@@ -1,36 +1,162 @@
 #include "QLearningSimulate.hpp"
+#include "AllocCounter.hpp"
+#include "SharedQTable.hpp"
 
-QLearningSimulate::QLearningSimulate() { }
+QLearningSimulate::QLearningSimulate(): QLearningSimulate("", "") { }
 
 QLearningSimulate::QLearningSimulate(std::string qtablePath, 
                                      std::string policyPath):qtablePath(qtablePath), 
                                      policyPath(policyPath)
 {
    /*
-    * QLearner(epsilon, alpha, gamma, tsprate, fallcount, myTime);
-    * TODO: Make sure that the values of epsilon, gamma are optimal. @Ref: (Paper) epsilon = 0.3, alpha = 0.1
+    * QLearner(epsilon, alpha, gamma, tsprate, fallcount, myTime), see LearnerParams for the defaults.
    */
-   agent.init(0.05f, 0.8f, 0.2f, 0.7f, 50, 9.04);
-   myTime = 8.5;
+   perturbationTime = 9.04;
+   agent.init(LearnerParams(), perturbationTime);
+   lastTDError = 0.0;
+   evaluation = false;
+   sharedCapacity = 0;
+   startTime = 8.5;
+   watchWindow = 100;
+   framesSaved = 0;
+   myTime = startTime;
    timeStep = 0.5; /* To achieve randomness, make more realistic etc */
+   sensorPeriod = 0.01;
+   imuPeriod = 0.005;
+   imuLead = 0.1;
+   impactTime = -1.0;
+   impactSamples = 0;
+   detections = falseAlarms = latencySum = latencyMax = 0;
 }
 
 bool QLearningSimulate::initialize()
 {
-   if(agent.loadQTable(qtablePath) && agent.loadPolicy(policyPath))
+   bool loaded;
+   if(!sharedName.empty())
+      loaded = agent.shareQTable(sharedName, sharedCapacity, qtablePath);
+   else if(!slotPath.empty())
+      loaded = agent.openSlotFile(slotPath);
+   else if(!sortedPath.empty())
+      loaded = agent.openSortedQTable(sortedPath);
+   else
+      loaded = agent.loadQTable(qtablePath);
+   if(loaded && agent.loadPolicy(policyPath))
       return true;
    return false;
 }
 
+/*
+ * Keep the 'q-table' in the slot file 'path' (see SlotFile) instead of 'qtablePath': a save only writes the entries that
+ * changed since the previous one. Takes effect with the next initialize().
+*/
+void QLearningSimulate::setSlotFile(const std::string& path)
+{
+   slotPath = path;
+}
+
+/*
+ * Keep the 'q-table' in the sorted file 'path' (see SortedQTable) instead of 'qtablePath': it is opened without being read,
+ * the states are loaded as the episodes visit them. Takes effect with the next initialize().
+*/
+void QLearningSimulate::setSortedFile(const std::string& path)
+{
+   sortedPath = path;
+}
+
+/*
+ * Learn on the 'q-table' in the shared memory object 'name' (see SharedQTable), together with the other processes using
+ * it; 'capacity' entries per state if this process creates it. Takes effect with the next initialize().
+*/
+void QLearningSimulate::setSharedTable(const std::string& name, uint32_t capacity)
+{
+   sharedName = name;
+   sharedCapacity = capacity;
+}
+
+/*
+ * train(..) averages the 'q-table' with the other learners of the AggregationServer listening at 'path', every
+ * TrainOptions::syncEvery episodes.
+*/
+void QLearningSimulate::setAggregator(const std::string& path)
+{
+   aggregatorPath = path;
+}
+
+/*
+ * One sync with the aggregation service, see setAggregator(..).
+*/
+bool QLearningSimulate::synchronize()
+{
+   std::unique_lock<std::mutex> guard;
+   if(planner)
+   {
+      planner->sync();
+      guard = std::unique_lock<std::mutex>(planner->getLock());
+   }
+   if(agent.syncAggregator())
+      return true;
+   ERROR("Lost the aggregation service %s, going on alone\n", aggregatorPath.c_str());
+   return false;
+}
+
+/*
+ * Only the 'policy', for evaluation, see setEvaluation(..). The 'q-table' is not touched.
+*/
+bool QLearningSimulate::loadPolicy()
+{
+   return agent.loadPolicy(policyPath);
+}
+
+/*
+ * Evaluation of a frozen policy: the actions come from QLearner::justPolicy(..) and the outcome of an episode is not learned
+ * from, so nothing in the tables changes and there is nothing to save.
+*/
+void QLearningSimulate::setEvaluation(bool evaluation)
+{
+   this->evaluation = evaluation;
+}
+
+/*
+ * Dyna-Q style planning: 'steps' simulated updates from the learned model per real step, see DynaPlanner.
+*/
+void QLearningSimulate::enablePlanning(unsigned int steps)
+{
+   planner.reset(new DynaPlanner(agent, steps));
+}
+
+/*
+ * Use other hyperparameters than the defaults.
+*/
+void QLearningSimulate::configure(const LearnerParams& params)
+{
+   agent.init(params, perturbationTime);
+}
+
+/*
+ * Seed the simulation & the agent (each has its own generator), the same seed gives the same episodes.
+*/
+void QLearningSimulate::seed(uint64_t seed)
+{
+   rng.seed(seed);
+   agent.seed(seed ^ 0x9e3779b97f4a7c15ULL);
+}
+
+/*
+ * Keep at most 'capacity' entries in the 'Q' table, see QStore.
+*/
+void QLearningSimulate::setCapacity(size_t capacity, EvictionPolicy policy)
+{
+   agent.setCapacity(capacity, policy);
+}
+
 /*
  * Simulate the required sensor values i.e 'double lfrontL, double lfrontR, double rfrontL, double rfrontR, double lbackL, double lbackR, double rbackL, double rbackR' needed by QLearner::determineState(...).
  * Type = 0 (0.0), 1 (random), 2 (half random[probability]), 3 (odd (fix), even (random)), 4 ('-1' to represent "robot fall"), ..)
+ * 'sensorvalues' has to hold the 8 values.
 */
 
-double*  QLearningSimulate::simulateStateData(int type)
+void QLearningSimulate::simulateStateData(int type, double* sensorvalues)
 {
-   unsigned int sensorcount = 8;
-   double* sensorvalues = new double[sensorcount];
    switch(type)
    {
       case 0:
@@ -78,9 +204,23 @@ double*  QLearningSimulate::simulateStateData(int type)
            sensorvalues[i] = 0.0;
         break;
    }
+}
 
-   return sensorvalues;
-
+/*
+ * Simulated IMU reading at 'time': gravity plus sensor noise while standing, on top of that an exponentially decaying
+ * acceleration & angular rate spike from 'impactTime' on.
+*/
+void QLearningSimulate::simulateImuData(double time, ImuSample& sample)
+{
+   const double gravity[3] = { 0.0, 0.0, 9.81 };
+   double decay = 0.0;
+   if(impactTime >= 0.0 && time >= impactTime)
+      decay = exp(-(time - impactTime) / 0.03);
+   for(int i = 0; i < 3; i++)
+   {
+      sample.accel[i] = gravity[i] + randomUniform(-0.05, 0.05) + (decay * impactAccel[i]);
+      sample.gyro[i]  = randomUniform(-0.02, 0.02) + (decay * impactGyro[i]);
+   }
 }
 
 /*
@@ -90,23 +230,29 @@ double*  QLearningSimulate::simulateStateData(int type)
 
 /*
  * Use for selecting an action with probability 'p'
- * TODO: Use better version of random generation, sth like 'std::uniform_real_distribution'
 */
 
 bool QLearningSimulate::flipCoin(double p)
 {
-   double r = ((double) rand() / (RAND_MAX));
+   double r = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
    return r < p;
 }
 
+/*
+ * Uniformly distributed in [min, max].
+*/
+double QLearningSimulate::randomUniform(double min, double max)
+{
+   return std::uniform_real_distribution<double>(min, max)(rng);
+}
+
 /*
  * Generate random number in between the limit (boundry values included).
- * TODO: Use better version of random generation, sth like 'std::uniform_real_distribution'
 */
 
 int QLearningSimulate::randomLimit(unsigned int min, unsigned int max)
 {
-   return (min + (rand() % (int)(max - min + 1)));
+   return std::uniform_int_distribution<int>(min, max)(rng);
 }
 
 /*
@@ -124,48 +270,131 @@ FeetState QLearningSimulate::determineState(double lfrontL, double lfrontR, doub
    FeetState fstate;
    if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = ZERO_FSRS;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = R_BACK;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_BACK;
-   else if( (lfront < 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = R_FRONT;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = R_FRONT_BACK;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_BACK_R_FRONT;
-   else if( (lfront < 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront < 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK_R_FRONT;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = L_FRONT;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = L_FRONT_R_BACK;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_FRONT_BACK;
-   else if( (lfront > 1.0) && (rfront < 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront < 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = L_R_BACK_L_FRONT;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback < 1.0) )
       fstate = L_R_FRONT;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback < 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback < 1.0) && (rback >= 1.0) )
       fstate = L_R_FRONT_R_BACK;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback < 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback < 1.0) )
       fstate = L_R_FRONT_L_BACK;
-   else if( (lfront > 1.0) && (rfront > 1.0) && (lback > 1.0) && (rback > 1.0) )
+   else if( (lfront >= 1.0) && (rfront >= 1.0) && (lback >= 1.0) && (rback >= 1.0) )
       fstate = ALL_FSRS;
    return fstate;
 }
 
-int QLearningSimulate::run()
+/*
+ * One perturbation episode: the perturbation hits at 'perturbationTime', the agent watches the IMU stream (every 'imuPeriod')
+ * and reacts as soon as its impact detector fires, then the robot is watched for up to 'watchWindow' sensor frames (every
+ * 'sensorPeriod') and the 'q-value' is updated with the outcome. Time is virtual (see EventClock), the quiet time before the
+ * perturbation is skipped altogether.
+ * Returns 1 if the robot survived, 0 if it fell and -1 if no perturbation was detected within 'maxsteps' time steps.
+*/
+int QLearningSimulate::runEpisode(unsigned int maxsteps)
 {
-   if(initialize())
+   beginEpisode(maxsteps);
+   SimEvent event;
+   int outcome;
+   while(clock.next(event))
    {
-      agent.printQTable();
-//      agent.printCurrentPolicy();
-      int i = 0;
-      srand (time(NULL)); /* Seed random numbers */
-      while(i < 5)
+      if(handleEvent(event, outcome))
+         return outcome;
+   }
+   return -1;
+}
+
+/*
+ * Resets the agent & the clock and schedules the first events of an episode, see runEpisode(..).
+*/
+void QLearningSimulate::beginEpisode(unsigned int maxsteps)
+{
+   agent.resetEpisode();
+   clock.reset(startTime);
+   clock.schedule(perturbationTime, EVENT_PERTURBATION);
+   clock.schedule(std::max(startTime, perturbationTime - imuLead), EVENT_IMU);
+   horizon = startTime + (maxsteps * timeStep);
+   impactTime = -1.0;
+   impactSamples = 0;
+   watchCount = 0;
+}
+
+/*
+ * Handles one event of the episode (and schedules the follow-up events), true once the episode is over with 'outcome' set
+ * as runEpisode(..) returns it.
+*/
+bool QLearningSimulate::handleEvent(const SimEvent& event, int& outcome)
+{
+   myTime = event.time;
+   switch(event.type)
+   {
+      case EVENT_PERTURBATION:
+      {
+         /*
+          * Push from a random direction, mostly horizontal, of random strength.
+         */
+         impactTime = myTime;
+         if(trace)
+            trace->recordPerturbation(myTime);
+         double strength = randomUniform(2.0, 20.0);
+         double heading = randomUniform(0.0, 2.0 * M_PI);
+         impactAccel[0] = strength * cos(heading);
+         impactAccel[1] = strength * sin(heading);
+         impactAccel[2] = randomUniform(-0.2, 0.2) * strength;
+         impactGyro[0] = -0.1 * impactAccel[1];
+         impactGyro[1] = 0.1 * impactAccel[0];
+         impactGyro[2] = randomUniform(-0.5, 0.5);
+         break;
+      }
+      case EVENT_IMU:
+      {
+         ImuSample sample;
+         simulateImuData(myTime, sample);
+         if(trace)
+            trace->recordImu(myTime, sample);
+         if(impactTime >= 0.0)
+            impactSamples++;
+         if(agent.detectPerturbation(sample))
+         {
+            /*
+             * Latency: IMU samples after the first one that could see the impact.
+            */
+            if(impactTime < 0.0)
+               falseAlarms++;
+            else
+            {
+               unsigned long latency = impactSamples - 1;
+               detections++;
+               latencySum += latency;
+               latencyMax = std::max(latencyMax, latency);
+               LOG("Perturbation detected after %lu IMU samples.\n", latency);
+            }
+            clock.schedule(myTime, EVENT_DECISION);
+         }
+         else if(myTime + imuPeriod < horizon)
+            clock.schedule(myTime + imuPeriod, EVENT_IMU);
+         break;
+      }
+      case EVENT_DECISION:
       {
          /*
           * Step 0: Get the simulated 'feet' data.
@@ -177,85 +406,317 @@ int QLearningSimulate::run()
          else
             type = randomLimit(0, 3);
          LOG("Simulate Type: %i\n", type);
-         double* feetdata = simulateStateData(type);
+         simulateStateData(type, feetdata);
          /*
           * Step 1: Get the state of the feet
           * TODO: The sequence doesn't matter for now but in reality mode, change this accordingly :)
          */
-         FeetState fstate = determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
+         fstate = determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
                         feetdata[4], feetdata[5], feetdata[6], feetdata[7]);
-         State state;
          state.feet_state = fstate;
          LOG("fstate: %s\n", state.getName().c_str());
-         State nstate; /* next state after applying the 'action' */
+         if(trace)
+            trace->recordFeet(myTime, feetdata, fstate);
          /*
-          * Step 2: Detect Perturbation
+          * Step 2: Perturbation was detected on the IMU stream, see EVENT_IMU.
+          * Step 3: Take an appropriate action, since perturbation has occured :(
          */
-         agent.detectPerturbation(myTime);
-         if(agent.getHit())
+         std::unique_lock<std::mutex> guard;
+         if(planner)
+            guard = std::unique_lock<std::mutex>(planner->getLock());
+         #ifdef JUSTPOLICY
+            action = agent.justPolicy(state);
+         #else
+            action = evaluation ? agent.justPolicy(state) : agent.getAction(state);
+         #endif
+         if(!action.isValid())
          {
-            /*
-             * Step 3: Take an appropriate action, since perturbation has occured :(
-            */
-            Action action;
-            #ifdef JUSTPOLICY
-               action = agent.justPolicy(state);
-            #else
+            LOG("\t\t\tScrewed :'(\n");
+            while(!action.isValid())
                action = agent.getAction(state);
-            #endif
-            if(!action.isValid())
-            {
-               LOG("\t\t\tScrewed :'(\n");
-               while(!action.isValid())
-                  action = agent.getAction(state);
-            }
-            LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
-            LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
-            LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
-            LOG("Perturbation Occurs\n");
-            
-            LOG("Action after perturbation\n%s", action.getName().c_str());
-            agent.doAction(action);
-            /*
-             * Keep on getting FeetState for quite some time to make sure that robot survived the collission or not.
-            */
-            int count = 100;
-            while(count > 0)
-            {
-               /*
-                * Get the state of the robot again.
-               */
-               feetdata = simulateStateData(2);
-               fstate = determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
-                        feetdata[4], feetdata[5], feetdata[6], feetdata[7]);
-               /*
-                * Detect if collision has occured.
-               */
-               agent.detectFall(fstate);
-               count--;
-            }
-            
-            /*
-             * Step 4: Update the 'q-value' after the action, according to the reward.
-             * call the update(..) and finish this episode.
-            */
-            agent.update(state, action, nstate, agent.getReward());
-            
-            /*
-             * Step 5: Save the 'q-table' & 'policy' to persistent storage :)
-            */
-            if((agent.saveQTable(qtablePath)) && (agent.savePolicy(policyPath)))
-               LOG("Saved 'q-table' [%s] & 'policy' [%s].\n \t\t\t* Cheers *\t\t\t\n", 
-                    qtablePath.c_str(), policyPath.c_str());
-            else
-               LOG("Error in saving files %s ('q-table')/%s & ('policy')\n. Make Sure you have the permissions to store the files on your disk.\n", 
-                   qtablePath.c_str(), policyPath.c_str());
-            
+         }
+         LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
+         LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
+         LOG("*\t*\t*\t*\t*\t*\t*\t*\t*\t*\n");
+         LOG("Perturbation Occurs\n");
+         
+         LOG("Action after perturbation\n%s", action.getName().c_str());
+         if(guard.owns_lock())
+            guard.unlock();
+         if(trace)
+            trace->recordAction(myTime, fstate, action);
+         agent.doAction(action);
+         /*
+          * Keep on getting FeetState for quite some time to make sure that robot survived the collission or not, but
+          * only until the outcome is known.
+         */
+         watchCount = watchWindow;
+         agent.watchFall(watchWindow);
+         clock.schedule(myTime + sensorPeriod, EVENT_SENSOR);
+         break;
+      }
+      case EVENT_SENSOR:
+      {
+         /*
+          * Get the state of the robot again.
+         */
+         simulateStateData(2, feetdata);
+         fstate = determineState(feetdata[0], feetdata[1], feetdata[2], feetdata[3],
+                  feetdata[4], feetdata[5], feetdata[6], feetdata[7]);
+         if(trace)
+            trace->recordFeet(myTime, feetdata, fstate);
+         /*
+          * Detect if collision has occured.
+         */
+         agent.detectFall(fstate);
+         watchCount--;
+         if(watchCount > 0 && !agent.isFallDecided())
+         {
+            clock.schedule(myTime + sensorPeriod, EVENT_SENSOR);
             break;
          }
-         myTime += timeStep;
-         i++;
+         framesSaved += watchCount;
+         LOG("Fall watch decided after %i of %u frames.\n", watchWindow - watchCount, watchWindow);
+         nstate.feet_state = fstate;
+         
+         /*
+          * Step 4: Update the 'q-value' after the action, according to the reward.
+          * call the update(..) and finish this episode.
+         */
+         if(trace)
+            trace->recordOutcome(myTime, fstate, agent.getReward(), agent.getFall());
+         outcome = agent.getFall() ? 0 : 1;
+         if(evaluation)
+            return true;
+         if(planner)
+            lastTDError = fabs(planner->observe(state, action, nstate, agent.getReward()));
+         else
+         {
+            lastTDError = fabs(agent.getTDError(state, action, nstate, agent.getReward()));
+            agent.update(state, action, nstate, agent.getReward());
+         }
+         return true;
+      }
+   }
+   return false;
+}
+
+/*
+ * Coroutine version of 'episodes' runEpisode(..) calls: every event is co_awaited on the scheduler, so that it can interleave
+ * this robot with many others (see EpisodeScheduler). The robot lives in its own virtual time line, the episodes follow
+ * each other with a time step in between and the first one starts at a random offset within a time step, so that the
+ * robots of a scheduler do not all get hit at once. The outcomes are counted in getTrainStats().
+*/
+EpisodeTask QLearningSimulate::runEpisodes(EpisodeScheduler& scheduler, unsigned long episodes, unsigned int maxsteps)
+{
+   double base = randomUniform(0.0, timeStep); /* virtual time of this robot at the start of the episode */
+   stats = TrainStats();
+   for(unsigned long e = 0; e < episodes; e++)
+   {
+      beginEpisode(maxsteps);
+      SimEvent event;
+      int outcome = -1;
+      while(clock.next(event))
+      {
+         co_await scheduler.at(base + (event.time - startTime));
+         if(handleEvent(event, outcome))
+            break;
+      }
+      if(outcome == 1)
+         stats.survived++;
+      else if(outcome == 0)
+         stats.fell++;
+      stats.episodes++;
+      base += (clock.getTime() - startTime) + timeStep;
+   }
+   stats.updates = getUpdateCount();
+   stats.qtableSize = getQTableSize();
+}
+
+/*
+ * Pace the episodes in real time instead of virtual time, see EventClock.
+*/
+void QLearningSimulate::setRealTime(bool realtime)
+{
+   clock.setRealTime(realtime);
+}
+
+/*
+ * Record every sensor frame, IMU sample, perturbation, action & outcome of the following episodes to the binary trace 'path',
+ * see Trace.hpp.
+*/
+bool QLearningSimulate::recordTrace(const std::string& path)
+{
+   trace.reset(new TraceWriter());
+   if(trace->open(path))
+      return true;
+   ERROR("Error in creating the trace file %s\n", path.c_str());
+   trace.reset();
+   return false;
+}
+
+/*
+ * Offline learning from a recorded trace: every (state, action, outcome) of the trace is applied to the 'q-table' in trace
+ * order (as batches, see QLearner::updateBatch(..)), no simulator in the loop, then the 'q-table' & 'policy' are saved.
+ * Planning is not used, the result only depends on the loaded 'q-table' and the trace.
+*/
+int QLearningSimulate::replay(const std::string& path)
+{
+   TraceReader reader;
+   if(!reader.open(path))
+   {
+      ERROR("Error in loading the trace file %s\n", path.c_str());
+      return -1;
+   }
+   if(!initialize())
+   {
+      ERROR("Error in Loading files %s ('q-table')/%s & ('policy'), starting from scratch ...\n", qtablePath.c_str(), policyPath.c_str());
+      if(!agent.createPersistence(qtablePath, policyPath))
+         return -1;
+   }
+
+   typedef std::chrono::steady_clock Clock;
+   Clock::time_point start = Clock::now();
+   std::vector<Transition> transitions;
+   reader.getTransitions(transitions);
+   const size_t batch = QLearner::MAX_BATCH;
+   for(size_t pos = 0; pos < transitions.size(); pos += batch)
+      agent.updateBatch(std::span<const Transition>(transitions.data() + pos, std::min(batch, transitions.size() - pos)));
+   double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+   bool saved = save();
+   REPORT("Replayed '%s': %zu records, %zu transitions in %.3fs (%.0f updates/s), q-table: %zu entries\n", path.c_str(),
+          reader.size(), transitions.size(), elapsed, elapsed > 0.0 ? transitions.size() / elapsed : 0.0, getQTableSize());
+   return saved ? 1 : -1;
+}
+
+/*
+ * Of a shared 'q-table' only the saver saves it (see SharedQTable::claimSaver()), the others would write the same files
+ * at the same time. The role passes on when the saver detaches, so the last process to finish saves the final table.
+*/
+bool QLearningSimulate::persists() const
+{
+   const SharedQTable* shared = agent.getSharedQTable();
+   return !shared || shared->claimSaver();
+}
+
+/*
+ * Save the 'q-table' & 'policy' to persistent storage :)
+ * With async persistence this waits until the files are on disk.
+*/
+bool QLearningSimulate::save()
+{
+   if(!persists())
+      return true;
+   if(agent.getSlotFile())
+   {
+      std::unique_lock<std::mutex> guard;
+      if(planner)
+      {
+         planner->sync();
+         guard = std::unique_lock<std::mutex>(planner->getLock());
+      }
+      if(agent.checkpointSlots(true) && agent.savePolicy(policyPath))
+         return true;
+      ERROR("Error in saving files %s ('q-table')/%s & ('policy')\n", slotPath.c_str(), policyPath.c_str());
+      return false;
+   }
+   if(!sortedPath.empty())
+   {
+      std::unique_lock<std::mutex> guard;
+      if(planner)
+      {
+         planner->sync();
+         guard = std::unique_lock<std::mutex>(planner->getLock());
       }
+      if(agent.saveSortedQTable(sortedPath) && agent.savePolicy(policyPath))
+         return true;
+      ERROR("Error in saving files %s ('q-table')/%s & ('policy')\n", sortedPath.c_str(), policyPath.c_str());
+      return false;
+   }
+   if(writer)
+   {
+      checkpoint();
+      if(writer->flush())
+         return true;
+      ERROR("Error in saving files %s ('q-table')/%s & ('policy')\n", qtablePath.c_str(), policyPath.c_str());
+      return false;
+   }
+   std::unique_lock<std::mutex> guard;
+   if(planner)
+   {
+      planner->sync();
+      guard = std::unique_lock<std::mutex>(planner->getLock());
+   }
+   if((agent.saveQTable(qtablePath)) && (agent.savePolicy(policyPath)))
+   {
+      LOG("Saved 'q-table' [%s] & 'policy' [%s].\n \t\t\t* Cheers *\t\t\t\n", 
+           qtablePath.c_str(), policyPath.c_str());
+      return true;
+   }
+   ERROR("Error in saving files %s ('q-table')/%s & ('policy')\n. Make Sure you have the permissions to store the files on your disk.\n", 
+         qtablePath.c_str(), policyPath.c_str());
+   return false;
+}
+
+/*
+ * Save while training goes on. With async persistence only an O(1) snapshot of the 'Q' table is taken & queued, the files
+ * are formatted and written by the AsyncWriter thread; otherwise the same as save(). A write error shows up at the next
+ * save().
+*/
+bool QLearningSimulate::checkpoint()
+{
+   if(!persists())
+      return true;
+   if(agent.getSlotFile())
+   {
+      std::unique_lock<std::mutex> guard;
+      if(planner)
+      {
+         planner->sync();
+         guard = std::unique_lock<std::mutex>(planner->getLock());
+      }
+      return agent.checkpointSlots(false) && agent.savePolicy(policyPath);
+   }
+   if(!writer || !sortedPath.empty())
+      return save();
+   QStore snapshot;
+   {
+      std::unique_lock<std::mutex> guard;
+      if(planner)
+      {
+         planner->sync();
+         guard = std::unique_lock<std::mutex>(planner->getLock());
+      }
+      snapshot = agent.snapshot();
+   }
+   writer->write(qtablePath, [snapshot](std::string& out) { QLearner::formatQTable(snapshot, out); });
+   writer->write(policyPath, [snapshot](std::string& out) { QLearner::formatPolicy(snapshot, out); });
+   return true;
+}
+
+/*
+ * Write the 'q-table' & 'policy' on a background thread (io_uring if available and 'uring', pwrite otherwise), see
+ * AsyncWriter & checkpoint().
+*/
+void QLearningSimulate::setAsyncPersistence(bool enabled, bool uring)
+{
+   if(writer)
+      writer->flush();
+   writer.reset(enabled ? new AsyncWriter(uring) : NULL);
+}
+
+int QLearningSimulate::run()
+{
+   if(initialize())
+   {
+      agent.printQTable();
+//      agent.printCurrentPolicy();
+      seed(time(NULL)); /* Seed random numbers */
+      if(runEpisode(5) >= 0)
+         save();
+      if(planner)
+         planner->stop();
       agent.printQTable();
 
    }
@@ -272,4 +733,185 @@ int QLearningSimulate::run()
    return 1;
 }
 
+/*
+ * Headless training: runs episodes until 'options.episodes' episodes are done or 'options.seconds' have passed (whichever
+ * comes first, 0 = no limit), checkpoints every 'options.checkpointEvery' episodes (and at the end) and prints the throughput
+ * every 'options.reportEvery' seconds. Meant to be run with logging off, see setLogging(..).
+ * With 'options.persist' off the tables are neither loaded nor saved (e.g. for SweepRunner), see getTrainStats() for the
+ * outcome.
+*/
+int QLearningSimulate::train(const TrainOptions& options)
+{
+   if(options.persist && !initialize())
+   {
+      ERROR("Error in Loading files %s ('q-table')/%s & ('policy'), starting from scratch ...\n", qtablePath.c_str(), policyPath.c_str());
+      if(!agent.createPersistence(qtablePath, policyPath))
+         return -1;
+   }
+   seed(options.seed ? options.seed : time(NULL)); /* Seed random numbers */
+   if(!aggregatorPath.empty() && !agent.connectAggregator(aggregatorPath))
+   {
+      ERROR("Error in connecting to the aggregation service %s\n", aggregatorPath.c_str());
+      return -1;
+   }
+
+   typedef std::chrono::steady_clock Clock;
+   Clock::time_point start = Clock::now();
+   Clock::time_point lastreport = start;
+   unsigned long episodes = 0, survived = 0, fell = 0, checkpoints = 0;
+   framesSaved = 0;
+   detections = falseAlarms = latencySum = latencyMax = 0;
+   unsigned long lastepisodes = 0, lastupdates = 0;
+   /*
+    * Heap allocations of the episodes that did not grow the 'q-table' (steady state), with -DCOUNT_ALLOCATIONS.
+   */
+   unsigned long steadyepisodes = 0;
+   uint64_t steadyallocations = 0, startallocations = getHeapAllocations();
+   /*
+    * |TD error| & outcome of the last 'window' episodes, for the convergence.
+   */
+   unsigned int window = std::max(1u, options.window);
+   std::vector<double> tderrors(window, 0.0);
+   std::vector<int> outcomes(window, -1);
+   double tdsum = 0.0;
+   unsigned long windowsurvived = 0, windowfell = 0;
+   stats.convergedAt = 0;
+   double elapsed = 0.0;
+   while((options.episodes == 0 || episodes < options.episodes) && (options.seconds <= 0.0 || elapsed < options.seconds))
+   {
+      uint64_t allocations = getHeapAllocations();
+      size_t tablesize = planner ? 0 : agent.getQTableSize();
+      int outcome = runEpisode(options.maxSteps);
+      if(!planner && agent.getQTableSize() == tablesize)
+      {
+         steadyepisodes++;
+         steadyallocations += getHeapAllocations() - allocations;
+      }
+      if(outcome == 1)
+         survived++;
+      else if(outcome == 0)
+         fell++;
+
+      size_t slot = episodes % window;
+      double tderror = outcome >= 0 ? lastTDError : 0.0;
+      tdsum += tderror - tderrors[slot];
+      tderrors[slot] = tderror;
+      windowsurvived += (outcome == 1) - (outcomes[slot] == 1);
+      windowfell += (outcome == 0) - (outcomes[slot] == 0);
+      outcomes[slot] = outcome;
+      episodes++;
+      if(stats.convergedAt == 0 && episodes >= window && tdsum / window < options.tolerance)
+         stats.convergedAt = episodes;
+
+      if(agent.getAggregator() && agent.getAggregator()->isConnected() && options.syncEvery > 0 &&
+         episodes % options.syncEvery == 0)
+         synchronize();
+
+      if(options.persist && options.checkpointEvery > 0 && episodes % options.checkpointEvery == 0 && persists())
+      {
+         checkpoint();
+         checkpoints++;
+      }
+
+      Clock::time_point now = Clock::now();
+      elapsed = std::chrono::duration<double>(now - start).count();
+      double sincereport = std::chrono::duration<double>(now - lastreport).count();
+      if(options.reportEvery > 0.0 && sincereport >= options.reportEvery)
+      {
+         unsigned long updates = getUpdateCount();
+         REPORT("[%8.1fs] episodes: %lu (%.0f/s), updates: %lu (%.0f/s), q-table: %zu entries, survival: %.3f\n",
+                elapsed, episodes, (episodes - lastepisodes) / sincereport, updates, (updates - lastupdates) / sincereport,
+                getQTableSize(), (survived + fell) ? (double) survived / (survived + fell) : 0.0);
+         lastreport = now;
+         lastepisodes = episodes;
+         lastupdates = updates;
+      }
+   }
+   if(agent.getAggregator() && agent.getAggregator()->isConnected())
+      synchronize();
+   bool saved = true;
+   if(options.persist)
+   {
+      bool persisting = persists();
+      saved = save();
+      checkpoints += persisting;
+   }
+   if(trace)
+      saved = trace->close() && saved;
+   if(planner)
+      planner->stop();
+
+   elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+   unsigned long updates = getUpdateCount();
+   stats.episodes = episodes;
+   stats.survived = survived;
+   stats.fell = fell;
+   stats.updates = updates;
+   stats.seconds = elapsed;
+   stats.windowSurvival = (windowsurvived + windowfell) ? (double) windowsurvived / (windowsurvived + windowfell) : 0.0;
+   stats.windowTDError = tdsum / std::min<unsigned long>(std::max(1ul, episodes), window);
+   stats.qtableSize = getQTableSize();
+   if(!options.summary)
+      return saved ? 1 : -1;
+   REPORT("\nTraining summary\n");
+   REPORT("  episodes    : %lu in %.2fs (%.0f episodes/s)\n", episodes, elapsed, elapsed > 0.0 ? episodes / elapsed : 0.0);
+   REPORT("  updates     : %lu (%.0f updates/s)\n", updates, elapsed > 0.0 ? updates / elapsed : 0.0);
+   REPORT("  outcomes    : %lu survived, %lu fell, %lu without perturbation\n", survived, fell, episodes - survived - fell);
+   REPORT("  q-table     : %zu entries\n", getQTableSize());
+   if(stats.convergedAt)
+      REPORT("  convergence : mean |TD error| < %g after %lu episodes (last %u: %g)\n", options.tolerance, stats.convergedAt,
+             window, stats.windowTDError);
+   else
+      REPORT("  convergence : mean |TD error| of the last %u episodes is %g (not below %g)\n", window, stats.windowTDError,
+             options.tolerance);
+   REPORT("  fall watch  : %lu of %lu frames saved by early exit\n", framesSaved, (survived + fell) * watchWindow);
+   REPORT("  detection   : %lu impacts, latency %.2f IMU samples mean, %lu max (%.1f ms/sample), %lu false alarms\n",
+          detections, detections ? (double) latencySum / detections : 0.0, latencyMax, imuPeriod * 1000.0, falseAlarms);
+   if(trace)
+      REPORT("  trace       : %lu records\n", trace->getRecordCount());
+   if(isCountingAllocations())
+      REPORT("  heap allocs : %lu in %lu steady-state episodes (%.3f per episode), %lu in total\n", (unsigned long) steadyallocations,
+             steadyepisodes, steadyepisodes ? (double) steadyallocations / steadyepisodes : 0.0,
+             (unsigned long) (getHeapAllocations() - startallocations));
+   REPORT("  checkpoints : %lu ('%s', '%s')\n", checkpoints, qtablePath.c_str(), policyPath.c_str());
+   if(agent.getSlotFile())
+      REPORT("  slot file   : %u slots, %lu records written in %lu writes ('%s')\n", agent.getSlotFile()->getSlots(),
+             agent.getSlotFile()->getRecordsWritten(), agent.getSlotFile()->getWrites(), slotPath.c_str());
+   if(!sortedPath.empty())
+      REPORT("  sorted file : %u of 16 states loaded from '%s'\n", agent.getPagedStates(), sortedPath.c_str());
+   if(agent.getAggregator())
+      REPORT("  aggregation : %lu syncs with '%s', %lu deltas sent (%lu bytes), %lu merged values received (%lu bytes)\n",
+             agent.getAggregator()->getSyncs(), aggregatorPath.c_str(), agent.getAggregator()->getSent(),
+             (unsigned long) agent.getAggregator()->getBytesOut(), agent.getAggregator()->getReceived(),
+             (unsigned long) agent.getAggregator()->getBytesIn());
+   if(agent.getSharedQTable())
+      REPORT("  shared      : '%s', %u entries per state, %u processes attached, %lu inserts dropped (full)%s\n",
+             sharedName.c_str(), agent.getSharedQTable()->getCapacity(), agent.getSharedQTable()->getAttached(),
+             (unsigned long) agent.getSharedQTable()->getDropped(),
+             checkpoints ? "" : ", not saved by this process (another attached process saves it)");
+   if(writer)
+      REPORT("  persistence : %s in the background, %lu files written, %lu stale files skipped\n", writer->getBackend(),
+             writer->getWritten(), writer->getSkipped());
+   return saved ? 1 : -1;
+}
 
+const TrainStats& QLearningSimulate::getTrainStats() const
+{
+   return stats;
+}
+
+unsigned long QLearningSimulate::getUpdateCount()
+{
+   std::unique_lock<std::mutex> guard;
+   if(planner)
+      guard = std::unique_lock<std::mutex>(planner->getLock());
+   return agent.getUpdateCount();
+}
+
+size_t QLearningSimulate::getQTableSize()
+{
+   std::unique_lock<std::mutex> guard;
+   if(planner)
+      guard = std::unique_lock<std::mutex>(planner->getLock());
+   return agent.getQTableSize();
+}
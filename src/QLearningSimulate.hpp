@@ -1,19 +1,129 @@
+#ifndef _QLEARNINGSIMULATE_
+#define _QLEARNINGSIMULATE_
+
 #include "QLearner.hpp"
+#include "DynaPlanner.hpp"
+#include "EventClock.hpp"
+#include "Trace.hpp"
+#include "EpisodeScheduler.hpp"
+#include "AsyncWriter.hpp"
 #include <errno.h>
+#include <memory>
+#include <chrono>
+
+/*
+ * Limits of a headless training run, see QLearningSimulate::train(..). 0 means no limit.
+*/
+struct TrainOptions
+{
+   unsigned long episodes;
+   double seconds; /* wall-clock budget */
+   unsigned long checkpointEvery; /* save the 'q-table' & 'policy' every that many episodes (always at the end) */
+   double reportEvery; /* seconds between throughput reports */
+   unsigned int maxSteps; /* time steps per episode to wait for the perturbation */
+   bool persist; /* load the 'q-table' & 'policy' first and save them, false = in memory only */
+   bool summary; /* print the summary at the end */
+   uint64_t seed; /* 0 = seed from the clock */
+   unsigned int window; /* episodes over which the convergence & survival are measured */
+   double tolerance; /* converged once the mean |TD error| over 'window' episodes is below this */
+   unsigned long syncEvery; /* episodes between two syncs with the aggregation service, see setAggregator(..) */
+   TrainOptions(): episodes(0), seconds(0.0), checkpointEvery(0), reportEvery(5.0), maxSteps(5), persist(true), summary(true),
+                   seed(0), window(1000), tolerance(0.01), syncEvery(100) {}
+};
+
+/*
+ * Outcome of QLearningSimulate::train(..).
+*/
+struct TrainStats
+{
+   unsigned long episodes;
+   unsigned long survived;
+   unsigned long fell;
+   unsigned long updates;
+   double seconds;
+   unsigned long convergedAt; /* first episode at which the mean |TD error| of the last 'window' episodes was within
+                                 'tolerance', 0 = did not converge */
+   double windowSurvival; /* survival rate of the last 'window' episodes (with a perturbation) */
+   double windowTDError; /* mean |TD error| of the last 'window' updates */
+   size_t qtableSize;
+};
+
 class QLearningSimulate
 {
    QLearner agent;
    std::string qtablePath;
    std::string policyPath;
+   std::string slotPath; /* the 'q-table' is kept in this slot file instead of 'qtablePath', see setSlotFile(..) */
+   std::string sortedPath; /* ... or in this sorted file, see setSortedFile(..) */
+   std::string sharedName; /* ... or shared with other processes, see setSharedTable(..) */
+   uint32_t sharedCapacity;
+   std::string aggregatorPath; /* see setAggregator(..) */
+   double startTime;
+   double perturbationTime;
    double myTime;
    double timeStep;
+   double sensorPeriod;
+   double imuPeriod;
+   double imuLead; /* the IMU stream starts that long before the perturbation, earlier samples are just noise */
+   double impactTime; /* < 0 until the perturbation hits */
+   double impactAccel[3]; /* peak acceleration & angular rate of the impact */
+   double impactGyro[3];
+   double horizon; /* no more IMU samples after that time, in the current episode */
+   double feetdata[8]; /* last sensor frame */
+   State state; /* at the decision */
+   State nstate; /* next state after applying the 'action' */
+   Action action;
+   FeetState fstate;
+   int watchCount; /* FeetState frames left to watch */
+   EventClock clock;
+   unsigned int watchWindow; /* FeetState frames watched after an action */
+   unsigned long framesSaved; /* watch frames skipped because the outcome was already known */
+   unsigned long impactSamples; /* IMU samples since the impact, in the current episode */
+   unsigned long detections, falseAlarms, latencySum, latencyMax; /* detection latency in IMU samples */
+   std::unique_ptr<DynaPlanner> planner;
+   std::unique_ptr<TraceWriter> trace;
+   std::unique_ptr<AsyncWriter> writer; /* background persistence, see setAsyncPersistence(..) */
+   std::mt19937_64 rng;
+   double lastTDError; /* |TD error| of the last update, before the update */
+   bool evaluation; /* act on the loaded 'policy' only, never update, see setEvaluation(..) */
+   TrainStats stats;
 public:
    QLearningSimulate();
    QLearningSimulate(std::string qtablePath, std::string policyPath);
    bool initialize();
-   double* simulateStateData(int type);
+   bool loadPolicy();
+   void setEvaluation(bool evaluation);
+   void enablePlanning(unsigned int steps);
+   void setCapacity(size_t capacity, EvictionPolicy policy = EVICT_LOW_VALUE);
+   void setRealTime(bool realtime);
+   void configure(const LearnerParams& params);
+   void seed(uint64_t seed);
+   bool recordTrace(const std::string& path);
+   int replay(const std::string& path);
+   void simulateStateData(int type, double* sensorvalues);
+   void simulateImuData(double time, ImuSample& sample);
+   double randomUniform(double min, double max);
    int randomLimit(unsigned int min, unsigned int max);
    bool flipCoin (double p);
    FeetState determineState(double lfrontL, double lfrontR, double rfrontL, double rfrontR, double lbackL, double lbackR, double rbackL, double rbackR);
+   int runEpisode(unsigned int maxsteps);
+   void beginEpisode(unsigned int maxsteps);
+   bool handleEvent(const SimEvent& event, int& outcome);
+   EpisodeTask runEpisodes(EpisodeScheduler& scheduler, unsigned long episodes, unsigned int maxsteps);
+   bool save();
+   bool checkpoint();
+   bool persists() const;
+   void setAsyncPersistence(bool enabled, bool uring = true);
+   void setSlotFile(const std::string& path);
+   void setSortedFile(const std::string& path);
+   void setSharedTable(const std::string& name, uint32_t capacity);
+   void setAggregator(const std::string& path);
+   bool synchronize();
    int run();
+   int train(const TrainOptions& options);
+   const TrainStats& getTrainStats() const;
+   unsigned long getUpdateCount();
+   size_t getQTableSize();
 };
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _QRECORD_
+#define _QRECORD_
+
+#include "QStore.hpp"
+#include <string.h>
+
+/*
+ * Binary 'Q' table files: a QFileHeader followed by fixed-size QRecords, in host byte order. The magic tells the layout
+ * apart, e.g. SlotFile ("QLSL": a record per slot, in slot order).
+*/
+struct QFileHeader
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t recordsize; /* sizeof(QRecord) */
+   uint32_t reserved;
+};
+
+/*
+ * Unused record (e.g. the slot of an evicted entry).
+*/
+static const uint8_t QRECORD_FREE = 0xff;
+
+struct QRecord
+{
+   uint64_t action; /* Action::getKey() */
+   float qvalue; /* always float on disk, whatever qvalue_t is */
+   uint32_t visits;
+   uint8_t state; /* FeetState, QRECORD_FREE */
+   uint8_t reserved[7];
+};
+
+static_assert(sizeof(QFileHeader) == 16 && sizeof(QRecord) == 24, "q-table records are meant to be fixed-size");
+
+/*
+ * Record of the entry at 'pos' of 'state'.
+*/
+inline QRecord makeQRecord(const QStore& table, FeetState state, size_t pos)
+{
+   QRecord record;
+   memset(&record, 0, sizeof(record));
+   record.action = table.getKey(state, pos);
+   record.qvalue = (float) table.getQValue(state, pos);
+   record.visits = table.getVisits(state, pos);
+   record.state = state;
+   return record;
+}
+
+#endif
@@ -0,0 +1,606 @@
+#include "QStore.hpp"
+#include "QKernels.hpp"
+#include "SortedQTable.hpp"
+#include "SharedQTable.hpp"
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+
+QStore::QStore(): count(0), capacity(0), policy(EVICT_LOW_VALUE), visitweight(1.0), clock(0), evictions(0), copies(0),
+                  tracking(0), paged(0xffff)
+{
+   for(int s = 0; s < 16; s++)
+      buckets[s] = std::make_shared<Bucket>();
+}
+
+/*
+ * O(1): the copy shares every bucket with this table, see write(..). Of a shared table: a private copy of its entries.
+*/
+QStore QStore::snapshot() const
+{
+   if(!shared)
+      return *this;
+   QStore copy;
+   for(int s = 0; s < 16; s++)
+   {
+      Bucket& bucket = copy.write(s);
+      size_t n = shared->getStateSize((FeetState) s);
+      for(size_t pos = 0; pos < n; pos++)
+      {
+         bucket.index.emplace(shared->getKey((FeetState) s, pos), (uint32_t) pos);
+         bucket.keys.push_back(shared->getKey((FeetState) s, pos));
+         bucket.values.push_back(shared->getValue((FeetState) s, pos));
+         bucket.visits.push_back(shared->getVisits((FeetState) s, pos));
+      }
+      bucket.lastaccess.assign(n, 0);
+      bucket.slots.assign(n, NO_SLOT);
+      bucket.dirty.assign(n, 0);
+      copy.count += n;
+   }
+   return copy;
+}
+
+/*
+ * The bucket of 'state' for modification. A bucket still shared with a snapshot is copied first, so that the snapshot keeps
+ * seeing the old values; only the buckets a table writes to after the snapshot are ever copied.
+*/
+QStore::Bucket& QStore::write(int state)
+{
+   get(state);
+   if(buckets[state].use_count() > 1)
+   {
+      buckets[state] = std::make_shared<Bucket>(*buckets[state]);
+      copies++;
+   }
+   else
+      std::atomic_thread_fence(std::memory_order_acquire); /* the last other owner may have just released it */
+   return *buckets[state];
+}
+
+/*
+ * capacity = 0 means unbounded. Shrinking below the current size evicts right away.
+*/
+void QStore::setCapacity(size_t capacity, EvictionPolicy policy, double visitweight)
+{
+   this->capacity    = capacity;
+   this->policy      = policy;
+   this->visitweight = visitweight;
+   while(capacity > 0 && count > capacity)
+      evict();
+}
+
+/*
+ * Looks up Q(state, action), returns false if the pair is not in the table.
+*/
+bool QStore::find(FeetState state, uint64_t action, double& qvalue)
+{
+   if(shared)
+   {
+      long pos = shared->find(state, action);
+      if(pos < 0)
+         return false;
+      qvalue = dequantize(shared->getValue(state, pos));
+      return true;
+   }
+   const Bucket& bucket = get(state);
+   std::unordered_map<uint64_t, uint32_t>::const_iterator found = bucket.index.find(action);
+   if(found == bucket.index.end())
+      return false;
+   uint32_t pos = found->second;
+   qvalue = dequantize(bucket.values[pos]);
+   /*
+    * The access time only matters to EVICT_LRU, don't copy a shared bucket just for a lookup otherwise.
+   */
+   if(policy == EVICT_LRU || buckets[state].use_count() == 1)
+      write(state).lastaccess[pos] = ++clock;
+   return true;
+}
+
+bool QStore::update(FeetState state, uint64_t action, double qvalue)
+{
+   if(shared)
+   {
+      long pos = shared->find(state, action);
+      if(pos < 0)
+         return false;
+      shared->update(state, pos, qvalue);
+      return true;
+   }
+   std::unordered_map<uint64_t, uint32_t>::const_iterator found = get(state).index.find(action);
+   if(found == get(state).index.end())
+      return false;
+   uint32_t pos = found->second;
+   Bucket& bucket = write(state);
+   bucket.lastaccess[pos] = ++clock;
+   if(bucket.visits[pos] < UINT32_MAX)
+      bucket.visits[pos]++;
+   bucket.values[pos] = quantize(qvalue);
+   markDirty(bucket, state, pos, tracking);
+   return true;
+}
+
+/*
+ * The caller makes sure that the pair is not in the table yet (see find(..)). False if it was dropped, which only a shared
+ * table does once the state is full (see SharedQTable::getDropped()).
+*/
+bool QStore::insert(FeetState state, uint64_t action, double qvalue)
+{
+   if(shared)
+      return shared->insert(state, action, qvalue) >= 0;
+   if(capacity > 0 && count >= capacity)
+      evict();
+   Bucket& bucket = write(state);
+   bucket.index.emplace(action, (uint32_t) bucket.keys.size());
+   bucket.keys.push_back(action);
+   bucket.values.push_back(quantize(qvalue));
+   bucket.visits.push_back(0);
+   bucket.lastaccess.push_back(++clock);
+   bucket.slots.push_back(NO_SLOT);
+   bucket.dirty.push_back(0);
+   count++;
+   markDirty(bucket, state, bucket.keys.size() - 1, tracking);
+   return true;
+}
+
+/*
+ * Sets Q(state, action), inserting it if need be, to a value that was merged elsewhere (see AggregationClient): not
+ * counted as a visit, and only dirty for the slot file (it still has to be saved, but is no change of this table to sync).
+*/
+void QStore::assign(FeetState state, uint64_t action, double qvalue)
+{
+   if(shared)
+   {
+      long pos = shared->find(state, action);
+      if(pos < 0)
+         shared->insert(state, action, qvalue);
+      else
+         shared->update(state, pos, qvalue);
+      return;
+   }
+   std::unordered_map<uint64_t, uint32_t>::const_iterator found = get(state).index.find(action);
+   if(found == get(state).index.end())
+   {
+      uint8_t wastracking = tracking;
+      tracking &= 1u << DIRTY_SLOTS;
+      insert(state, action, qvalue);
+      tracking = wastracking;
+      return;
+   }
+   uint32_t pos = found->second;
+   Bucket& bucket = write(state);
+   bucket.values[pos] = quantize(qvalue);
+   markDirty(bucket, state, pos, tracking & (1u << DIRTY_SLOTS));
+}
+
+/*
+ * insert(..) of an entry read back from the slot file 'slot', with its visit count; not dirty.
+*/
+void QStore::insertSlot(FeetState state, uint64_t action, double qvalue, uint32_t visits, uint32_t slot)
+{
+   uint8_t wastracking = tracking;
+   tracking = 0;
+   insert(state, action, qvalue);
+   tracking = wastracking;
+   Bucket& bucket = write(state);
+   bucket.visits.back() = visits;
+   bucket.slots.back() = slot;
+}
+
+/*
+ * Lists the entry in every DirtyList of 'lists' (bits) it is not in yet.
+*/
+void QStore::markDirty(Bucket& bucket, int state, uint32_t pos, uint8_t lists)
+{
+   lists &= ~bucket.dirty[pos];
+   if(!lists)
+      return;
+   bucket.dirty[pos] |= lists;
+   for(int list = 0; list < DIRTY_LISTS; list++)
+      if(lists & (1u << list))
+         dirtylists[list].push_back(std::make_pair((uint8_t) state, bucket.keys[pos]));
+}
+
+/*
+ * Start (or stop) listing the changed entries in 'list', see getDirty(..). Starts with a clean list.
+*/
+void QStore::setDirtyTracking(DirtyList list, bool tracking)
+{
+   clearDirty(list);
+   if(tracking)
+      this->tracking |= 1u << list;
+   else
+      this->tracking &= ~(1u << list);
+}
+
+uint32_t QStore::getVisits(FeetState state, size_t pos) const
+{
+   if(shared)
+      return shared->getVisits(state, pos);
+   return get(state).visits[pos];
+}
+
+uint32_t QStore::getSlot(FeetState state, size_t pos) const
+{
+   return get(state).slots[pos];
+}
+
+void QStore::setSlot(FeetState state, size_t pos, uint32_t slot)
+{
+   write(state).slots[pos] = slot;
+}
+
+/*
+ * # of entries changed since the last clearDirty(list), some of them may have been evicted again.
+*/
+size_t QStore::getDirtySize(DirtyList list) const
+{
+   return dirtylists[list].size();
+}
+
+/*
+ * Where the i-th changed entry of 'list' is now, false if it was evicted since.
+*/
+bool QStore::getDirty(DirtyList list, size_t i, FeetState& state, size_t& pos) const
+{
+   state = (FeetState) dirtylists[list][i].first;
+   const Bucket& bucket = get(state);
+   std::unordered_map<uint64_t, uint32_t>::const_iterator found = bucket.index.find(dirtylists[list][i].second);
+   if(found == bucket.index.end())
+      return false;
+   pos = found->second;
+   return true;
+}
+
+/*
+ * Slots of the entries evicted since the last clearDirty(DIRTY_SLOTS).
+*/
+const std::vector<uint32_t>& QStore::getFreedSlots() const
+{
+   return freedslots;
+}
+
+/*
+ * Everything changed so far went where 'list' is for (saved, synced). O(changed entries), keeps the memory of the list.
+*/
+void QStore::clearDirty(DirtyList list)
+{
+   FeetState state;
+   size_t pos;
+   for(size_t i = 0; i < dirtylists[list].size(); i++)
+   {
+      if(getDirty(list, i, state, pos))
+         write(state).dirty[pos] &= ~(1u << list);
+   }
+   dirtylists[list].clear();
+   if(list == DIRTY_SLOTS)
+      freedslots.clear();
+}
+
+/*
+ * The bucket of 'state', paged in from the attached file on first use.
+*/
+const QStore::Bucket& QStore::get(int state) const
+{
+   if(!(paged & (1u << state)))
+      page(state);
+   return *buckets[state];
+}
+
+/*
+ * Reads the records of 'state' (contiguous & sorted in the file) into a bucket of its own; the bucket shared with
+ * snapshots taken before stays empty. open(..) does not read the records, so a damaged file may repeat an action: only
+ * its first record is kept, and the size taken from the file index is corrected.
+*/
+void QStore::page(int state) const
+{
+   size_t n = backing->getStateSize((FeetState) state);
+   const QRecord* records = backing->getState((FeetState) state);
+   std::shared_ptr<Bucket> bucket = std::make_shared<Bucket>();
+   bucket->keys.reserve(n);
+   bucket->values.reserve(n);
+   bucket->visits.reserve(n);
+   bucket->index.reserve(n);
+   for(size_t i = 0; i < n; i++)
+   {
+      if(!bucket->index.emplace(records[i].action, (uint32_t) bucket->keys.size()).second)
+         continue;
+      bucket->keys.push_back(records[i].action);
+      bucket->values.push_back(quantize(records[i].qvalue));
+      bucket->visits.push_back(records[i].visits);
+   }
+   size_t kept = bucket->keys.size();
+   bucket->lastaccess.assign(kept, 0);
+   bucket->slots.assign(kept, NO_SLOT);
+   bucket->dirty.assign(kept, 0);
+   count -= n - kept;
+   buckets[state] = bucket;
+   paged |= 1u << state;
+}
+
+/*
+ * Replaces the content of the table by the sorted file 'file' (see SortedQTable) without reading it: a state's entries
+ * are paged in when the state is first used. Whatever goes over all states (evict(), SortedQTable::write(..), ...) pages
+ * in everything.
+*/
+void QStore::attach(std::shared_ptr<const SortedQTable> file)
+{
+   clear();
+   backing = file;
+   paged = 0;
+   for(int s = 0; s < 16; s++)
+   {
+      if(file->getStateSize((FeetState) s) == 0)
+         paged |= 1u << s;
+   }
+   count = file->size();
+}
+
+/*
+ * True if attach(..) gave the table a sorted file to page the states in from.
+*/
+bool QStore::isAttached() const
+{
+   return backing != nullptr;
+}
+
+/*
+ * States read from the attached file so far.
+*/
+unsigned int QStore::getPagedStates() const
+{
+   unsigned int states = 0;
+   for(int s = 0; s < 16; s++)
+   {
+      if(backing && (paged & (1u << s)) && backing->getStateSize((FeetState) s) > 0)
+         states++;
+   }
+   return states;
+}
+
+/*
+ * Detaches from any file or other table and works on 'table' from then on (see SharedQTable), without copying anything.
+*/
+void QStore::share(std::shared_ptr<SharedQTable> table)
+{
+   clear();
+   shared = table;
+}
+
+/*
+ * NULL unless share(..)d.
+*/
+const SharedQTable* QStore::getShared() const
+{
+   return shared.get();
+}
+
+/*
+ * The attached file while 'state' is still only there (& unchanged), else NULL.
+*/
+const SortedQTable* QStore::getBacking(FeetState state) const
+{
+   return (paged & (1u << state)) ? NULL : backing.get();
+}
+
+/*
+ * Neither of them pages the state in.
+*/
+bool QStore::hasState(FeetState state) const
+{
+   return getStateSize(state) > 0;
+}
+
+size_t QStore::getStateSize(FeetState state) const
+{
+   if(shared)
+      return shared->getStateSize(state);
+   if(!(paged & (1u << state)))
+      return backing->getStateSize(state);
+   return buckets[state]->keys.size();
+}
+
+/*
+ * Unpacked copy of an entry, for printing/saving etc.
+*/
+QTable QStore::getEntry(FeetState state, size_t pos) const
+{
+   QTable q;
+   q.state_action_pair.state.feet_state = state;
+   q.state_action_pair.action.setKey(getKey(state, pos));
+   q.qvalue = getQValue(state, pos);
+   return q;
+}
+
+QEntry QStore::getRecord(FeetState state, size_t pos) const
+{
+   QEntry entry;
+   entry.action = getKey(state, pos);
+   entry.qvalue = shared ? shared->getValue(state, pos) : get(state).values[pos];
+   entry.state = state;
+   return entry;
+}
+
+double QStore::getQValue(FeetState state, size_t pos) const
+{
+   if(shared)
+      return dequantize(shared->getValue(state, pos));
+   return dequantize(get(state).values[pos]);
+}
+
+/*
+ * The contiguous (quantized) q-value column of a state, getStateSize(..) long.
+*/
+const qvalue_t* QStore::getQValues(FeetState state) const
+{
+   if(shared)
+      return shared->getValues(state);
+   return get(state).values.data();
+}
+
+uint64_t QStore::getKey(FeetState state, size_t pos) const
+{
+   if(shared)
+      return shared->getKey(state, pos);
+   return get(state).keys[pos];
+}
+
+/*
+ * Position of the (first) max q-value of a state, -1 if nothing was tried in that state. Only reads the q-value column,
+ * with the SIMD kernel of QKernels.hpp.
+*/
+long QStore::argmax(FeetState state) const
+{
+   if(shared)
+      return shared->argmax(state);
+   return argmaxQValues(get(state).values.data(), get(state).values.size());
+}
+
+/*
+ * The value find(..) returns after update(..)/insert(..) stored 'qvalue'.
+*/
+double QStore::round(double qvalue)
+{
+   return dequantize(quantize(qvalue));
+}
+
+size_t QStore::size() const
+{
+   if(shared)
+      return shared->size();
+   return count;
+}
+
+size_t QStore::getCapacity() const
+{
+   return capacity;
+}
+
+/*
+ * Total # of evicted entries, lets callers caching 'q-values' notice that the table changed under them.
+*/
+uint64_t QStore::getEvictions() const
+{
+   return evictions;
+}
+
+/*
+ * Total # of buckets copied on write because they were shared with a snapshot.
+*/
+uint64_t QStore::getCopies() const
+{
+   return copies;
+}
+
+/*
+ * Snapshots sharing the buckets keep their entries.
+*/
+void QStore::clear()
+{
+   for(int s = 0; s < 16; s++)
+   {
+      if(buckets[s].use_count() > 1)
+      {
+         buckets[s] = std::make_shared<Bucket>();
+         continue;
+      }
+      buckets[s]->keys.clear();
+      buckets[s]->values.clear();
+      buckets[s]->visits.clear();
+      buckets[s]->lastaccess.clear();
+      buckets[s]->slots.clear();
+      buckets[s]->dirty.clear();
+      buckets[s]->index.clear();
+   }
+   count = 0;
+   for(int list = 0; list < DIRTY_LISTS; list++)
+      dirtylists[list].clear();
+   freedslots.clear();
+   backing.reset();
+   paged = 0xffff;
+   shared.reset();
+}
+
+/*
+ * Lower score = evicted first.
+*/
+double QStore::getScore(const Bucket& bucket, uint32_t pos) const
+{
+   switch(policy)
+   {
+      case EVICT_LFU:
+         return (double) bucket.visits[pos];
+      case EVICT_LRU:
+         return (double) bucket.lastaccess[pos];
+      case EVICT_LOW_VALUE:
+      default:
+         return dequantize(bucket.values[pos]) + (visitweight * log2(1.0 + bucket.visits[pos]));
+   }
+}
+
+/*
+ * Evicts the worst 1/64th of the capacity (at least one entry) in one go, so that a full table pays for the scan only once
+ * every so many inserts.
+*/
+void QStore::evict()
+{
+   struct Victim
+   {
+      double score;
+      int state;
+      uint32_t pos;
+   };
+   std::vector<Victim> victims;
+   victims.reserve(count);
+   for(int s = 0; s < 16; s++)
+      for(uint32_t pos = 0; pos < get(s).keys.size(); pos++)
+      {
+         Victim victim;
+         victim.score = getScore(get(s), pos);
+         victim.state = s;
+         victim.pos = pos;
+         victims.push_back(victim);
+      }
+   if(victims.empty())
+      return;
+
+   size_t n = std::max<size_t>(1, capacity / 64);
+   if(capacity > 0 && count > capacity)
+      n += count - capacity;
+   n = std::min(n, victims.size());
+   std::nth_element(victims.begin(), victims.begin() + (n - 1), victims.end(),
+                    [](const Victim& a, const Victim& b) { return a.score < b.score; });
+   /*
+    * erase(..) moves the last entry of the bucket into the hole, so go from the back of every bucket to the front.
+   */
+   std::sort(victims.begin(), victims.begin() + n,
+             [](const Victim& a, const Victim& b) { return a.state != b.state ? a.state < b.state : a.pos > b.pos; });
+   for(size_t i = 0; i < n; i++)
+      erase(victims[i].state, victims[i].pos);
+   evictions += n;
+}
+
+void QStore::erase(int state, uint32_t pos)
+{
+   Bucket& bucket = write(state);
+   uint32_t last = bucket.keys.size() - 1;
+   bucket.index.erase(bucket.keys[pos]);
+   if((tracking & (1u << DIRTY_SLOTS)) && bucket.slots[pos] != NO_SLOT)
+      freedslots.push_back(bucket.slots[pos]);
+   if(pos != last)
+   {
+      bucket.keys[pos]       = bucket.keys[last];
+      bucket.values[pos]     = bucket.values[last];
+      bucket.visits[pos]     = bucket.visits[last];
+      bucket.lastaccess[pos] = bucket.lastaccess[last];
+      bucket.slots[pos]      = bucket.slots[last];
+      bucket.dirty[pos]      = bucket.dirty[last];
+      bucket.index[bucket.keys[pos]] = pos;
+   }
+   bucket.keys.pop_back();
+   bucket.values.pop_back();
+   bucket.visits.pop_back();
+   bucket.lastaccess.pop_back();
+   bucket.slots.pop_back();
+   bucket.dirty.pop_back();
+   count--;
+}
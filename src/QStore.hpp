@@ -0,0 +1,214 @@
+#ifndef _QSTORE_
+#define _QSTORE_
+
+#include "core.hpp"
+#include <unordered_map>
+#include <memory>
+
+/*
+ * Which entries go first when a bounded 'Q' table is full.
+ * EVICT_LOW_VALUE: lowest 'q-value + visitweight * log2(1 + visits)', i.e. low valued & rarely visited entries.
+ * EVICT_LFU: least visited, EVICT_LRU: least recently accessed.
+*/
+enum EvictionPolicy{ EVICT_LOW_VALUE, EVICT_LFU, EVICT_LRU };
+
+/*
+ * Q-values are stored quantized: as float by default, or with -DQVALUE_FIXED16 as 16 bit fixed-point with 
+ * QVALUE_FIXED16_SCALE steps per unit (default 1024 i.e. a resolution of ~0.001 and a range of +-32, values outside are clamped).
+*/
+#ifdef QVALUE_FIXED16
+   #ifndef QVALUE_FIXED16_SCALE
+      #define QVALUE_FIXED16_SCALE 1024
+   #endif
+   typedef int16_t qvalue_t;
+#else
+   typedef float qvalue_t;
+#endif
+
+/*
+ * Compact 'Q' table entry, 16 bytes instead of the 100+ of a QTable. QStore keeps the fields in separate columns, this is
+ * the record handed out by QStore::getRecord(..).
+*/
+struct QEntry
+{
+   uint64_t action; /* Action::getKey() */
+   qvalue_t qvalue;
+   uint8_t state : 4; /* FeetState */
+};
+
+static_assert(sizeof(QEntry) <= 16, "QEntry is meant to stay compact");
+
+/*
+ * The users of the dirty tracking, each with a list of changed entries of its own (see QStore::setDirtyTracking(..)).
+ * DIRTY_SLOTS: SlotFile checkpoints, the only one that also gets the slots of the evicted entries.
+ * DIRTY_SYNC: AggregationClient syncs.
+*/
+enum DirtyList{ DIRTY_SLOTS, DIRTY_SYNC, DIRTY_LISTS };
+
+/*
+ * No slot in the slot file yet, see QStore::getSlot(..) & SlotFile.
+*/
+static const uint32_t NO_SLOT = UINT32_MAX;
+
+class SortedQTable;
+class SharedQTable;
+
+inline qvalue_t quantize(double qvalue)
+{
+#ifdef QVALUE_FIXED16
+   double scaled = qvalue * QVALUE_FIXED16_SCALE;
+   if(scaled > INT16_MAX)
+      return INT16_MAX;
+   if(scaled < INT16_MIN)
+      return INT16_MIN;
+   return (qvalue_t) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+#else
+   return (qvalue_t) qvalue;
+#endif
+}
+
+inline double dequantize(qvalue_t qvalue)
+{
+#ifdef QVALUE_FIXED16
+   return ((double) qvalue) / QVALUE_FIXED16_SCALE;
+#else
+   return (double) qvalue;
+#endif
+}
+
+/*
+ * Storage behind the 'Q' table, one bucket per FeetState, each bucket indexed by the packed action (Action::getKey()).
+ * Buckets are laid out as structure of arrays, so scans (argmax, policy, ...) only stream the column they need: the FeetState 
+ * column is the bucket itself, the keys, q-values and eviction book keeping are contiguous arrays of their own.
+ * With a capacity set, the table never holds more than 'capacity' entries: inserting into a full table first evicts the
+ * worst entries (1/64th of the capacity at once) according to the EvictionPolicy.
+ * The buckets are copy-on-write: snapshot() (as well as copying a QStore) is O(1) and shares all buckets, the first write
+ * to a shared bucket copies that bucket only. A snapshot can be read, saved or trained on in another thread while this table
+ * keeps changing; snapshot() itself has to be called by the thread writing this table.
+ * With dirty tracking on (see SlotFile) the table lists the entries inserted/updated and the slots of the entries evicted
+ * since the last clearDirty(), so that a checkpoint only has to write those (a snapshot() then copies these lists too).
+ * Every DirtyList is tracked & cleared on its own, so a sync with an AggregationServer does not eat the changes the next
+ * checkpoint has to write.
+ * A table attach(..)ed to a sorted file reads a state's entries from the file when the state is first used.
+ * A table share(..)d with other processes keeps no entries of its own, every call goes to the SharedQTable (no capacity
+ * or eviction, that table has its own fixed capacity); its snapshot() is a private copy, made in O(size).
+*/
+class QStore
+{
+   struct Bucket
+   {
+      std::vector<uint64_t> keys; /* Action::getKey() */
+      std::vector<qvalue_t> values;
+      std::vector<uint32_t> visits; /* # of updates, used by the eviction */
+      std::vector<uint64_t> lastaccess; /* value of 'clock' at the last lookup/update, used by the eviction */
+      std::vector<uint32_t> slots; /* position in the slot file, NO_SLOT if none yet */
+      std::vector<uint8_t> dirty; /* bit per DirtyList the entry is in */
+      std::unordered_map<uint64_t, uint32_t> index; /* packed action -> position in the columns */
+   };
+
+   mutable std::shared_ptr<Bucket> buckets[16]; /* replaced when paged in */
+   mutable size_t count; /* corrected when a state paged in has duplicates, see page(..) */
+   size_t capacity; /* 0 = unbounded */
+   EvictionPolicy policy;
+   double visitweight;
+   uint64_t clock;
+   uint64_t evictions;
+   uint64_t copies;
+   uint8_t tracking; /* bit per tracked DirtyList */
+   std::vector<std::pair<uint8_t, uint64_t>> dirtylists[DIRTY_LISTS]; /* <state, key> of the changed entries */
+   std::vector<uint32_t> freedslots; /* slots of the evicted entries, for DIRTY_SLOTS */
+   std::shared_ptr<const SortedQTable> backing; /* see attach(..) */
+   mutable uint16_t paged; /* states that are in memory (or not in 'backing') */
+   std::shared_ptr<SharedQTable> shared; /* see share(..) */
+
+   const Bucket& get(int state) const;
+
+   void page(int state) const;
+
+   Bucket& write(int state);
+
+   void markDirty(Bucket& bucket, int state, uint32_t pos, uint8_t lists);
+
+   double getScore(const Bucket& bucket, uint32_t pos) const;
+
+   void evict();
+
+   void erase(int state, uint32_t pos);
+
+public:
+
+   QStore();
+
+   QStore snapshot() const;
+
+   void setCapacity(size_t capacity, EvictionPolicy policy = EVICT_LOW_VALUE, double visitweight = 1.0);
+
+   bool find(FeetState state, uint64_t action, double& qvalue);
+
+   bool update(FeetState state, uint64_t action, double qvalue);
+
+   bool insert(FeetState state, uint64_t action, double qvalue);
+
+   void assign(FeetState state, uint64_t action, double qvalue);
+
+   bool hasState(FeetState state) const;
+
+   size_t getStateSize(FeetState state) const;
+
+   QTable getEntry(FeetState state, size_t pos) const;
+
+   QEntry getRecord(FeetState state, size_t pos) const;
+
+   double getQValue(FeetState state, size_t pos) const;
+
+   const qvalue_t* getQValues(FeetState state) const;
+
+   uint64_t getKey(FeetState state, size_t pos) const;
+
+   long argmax(FeetState state) const;
+
+   static double round(double qvalue);
+
+   size_t size() const;
+
+   size_t getCapacity() const;
+
+   uint64_t getEvictions() const;
+
+   uint64_t getCopies() const;
+
+   void clear();
+
+   void setDirtyTracking(DirtyList list, bool tracking);
+
+   void insertSlot(FeetState state, uint64_t action, double qvalue, uint32_t visits, uint32_t slot);
+
+   uint32_t getVisits(FeetState state, size_t pos) const;
+
+   uint32_t getSlot(FeetState state, size_t pos) const;
+
+   void setSlot(FeetState state, size_t pos, uint32_t slot);
+
+   size_t getDirtySize(DirtyList list) const;
+
+   bool getDirty(DirtyList list, size_t i, FeetState& state, size_t& pos) const;
+
+   const std::vector<uint32_t>& getFreedSlots() const;
+
+   void clearDirty(DirtyList list);
+
+   void attach(std::shared_ptr<const SortedQTable> file);
+
+   unsigned int getPagedStates() const;
+
+   bool isAttached() const;
+
+   const SortedQTable* getBacking(FeetState state) const;
+
+   void share(std::shared_ptr<SharedQTable> table);
+
+   const SharedQTable* getShared() const;
+
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "QTableMerger.hpp"
+#include <sys/stat.h>
+#include <queue>
+#include <optional>
+
+QTableMerger::QTableMerger(MergeRule rule): rule(rule), records(0), entries(0), conflicts(0) {}
+
+/*
+ * Opens (maps) the sorted 'Q' table file 'path' as one more input; false if it is not one.
+*/
+bool QTableMerger::addInput(const std::string& path)
+{
+   Input input;
+   input.table.reset(new SortedQTable());
+   input.path = path;
+   struct stat st;
+   if(stat(path.c_str(), &st) != 0 || !input.table->open(path, true))
+      return false;
+   input.mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+   inputs.push_back(std::move(input));
+   return true;
+}
+
+/*
+ * The policy entry of a merged record, with the q-value the merged table is going to hold.
+*/
+static QTable getPolicyEntry(const QRecord& record)
+{
+   QTable entry;
+   entry.state_action_pair.state.feet_state = (FeetState) record.state;
+   entry.state_action_pair.action.setKey(record.action);
+   entry.qvalue = QStore::round(record.qvalue);
+   return entry;
+}
+
+/*
+ * Accepts "max", "average" (visit weighted) and "latest".
+*/
+bool QTableMerger::parseRule(const std::string& name, MergeRule& rule)
+{
+   if(name == "max")
+      rule = MERGE_MAX;
+   else if(name == "average")
+      rule = MERGE_VISIT_AVERAGE;
+   else if(name == "latest")
+      rule = MERGE_LATEST;
+   else
+      return false;
+   return true;
+}
+
+/*
+ * Writes the merge of all the inputs to the sorted file 'qtablePath' and its 'policy' (the first action of max q-value
+ * of each state, as QLearner::getCurrentPolicy(..) would pick it from the merged table) to 'policyPath'.
+*/
+bool QTableMerger::merge(const std::string& qtablePath, const std::string& policyPath)
+{
+   struct Cursor
+   {
+      const QRecord* record;
+      const QRecord* end;
+      const QRecord* released; /* the records before were dropped from memory */
+      size_t input;
+   };
+   const size_t RELEASE_RECORDS = (1 << 20) / sizeof(QRecord);
+   /*
+    * Smallest <state, action> on top; the same pair comes out of the inputs in their order.
+   */
+   auto later = [](const Cursor& a, const Cursor& b)
+   {
+      if(a.record->state != b.record->state)
+         return a.record->state > b.record->state;
+      if(a.record->action != b.record->action)
+         return a.record->action > b.record->action;
+      return a.input > b.input;
+   };
+   std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(later);
+   for(size_t i = 0; i < inputs.size(); i++)
+   {
+      const QRecord* first = inputs[i].table->getState((FeetState) 0); /* the states follow each other */
+      if(inputs[i].table->size() > 0)
+         heap.push(Cursor{first, first + inputs[i].table->size(), first, i});
+   }
+
+   SortedQTableWriter writer;
+   if(!writer.open(qtablePath))
+      return false;
+   records = entries = conflicts = 0;
+   std::vector<QTable> policy;
+   std::optional<QRecord> best; /* max q-value of the current state so far */
+   while(!heap.empty())
+   {
+      /*
+       * Every copy of the pair on top of the heap.
+      */
+      QRecord merged = *heap.top().record;
+      double weighted = 0.0, sum = 0.0, visits = 0.0;
+      int64_t newest = INT64_MIN;
+      size_t copies = 0;
+      while(!heap.empty() && heap.top().record->state == merged.state && heap.top().record->action == merged.action)
+      {
+         Cursor cursor = heap.top();
+         heap.pop();
+         const QRecord& record = *cursor.record;
+         switch(rule)
+         {
+            case MERGE_MAX:
+               if(record.qvalue > merged.qvalue)
+                  merged.qvalue = record.qvalue;
+               break;
+            case MERGE_VISIT_AVERAGE:
+               weighted += (double) record.qvalue * record.visits;
+               sum += record.qvalue;
+               break;
+            case MERGE_LATEST:
+               if(inputs[cursor.input].mtime >= newest)
+               {
+                  newest = inputs[cursor.input].mtime;
+                  merged.qvalue = record.qvalue;
+               }
+               break;
+         }
+         visits += record.visits;
+         copies++;
+         records++;
+         if(++cursor.record - cursor.released >= (ptrdiff_t) RELEASE_RECORDS)
+         {
+            inputs[cursor.input].table->release(cursor.released, cursor.record);
+            cursor.released = cursor.record;
+         }
+         if(cursor.record != cursor.end)
+            heap.push(cursor);
+      }
+      if(rule == MERGE_VISIT_AVERAGE)
+         merged.qvalue = visits > 0.0 ? weighted / visits : sum / copies; /* never visited: plain mean */
+      merged.visits = visits < UINT32_MAX ? (uint32_t) visits : UINT32_MAX;
+      if(copies > 1)
+         conflicts++;
+      if(!writer.add(merged))
+         return false;
+      entries++;
+
+      /*
+       * The policy entry of a state is known once its last pair is merged.
+      */
+      if(best && best->state != merged.state)
+      {
+         policy.push_back(getPolicyEntry(*best));
+         best.reset();
+      }
+      if(!best || QStore::round(merged.qvalue) > QStore::round(best->qvalue))
+         best = merged;
+   }
+   if(best)
+      policy.push_back(getPolicyEntry(*best));
+   return writer.close() && QLearner::writePolicy(policy, policyPath);
+}
+
+size_t QTableMerger::getInputs() const
+{
+   return inputs.size();
+}
+
+unsigned long QTableMerger::getRecords() const
+{
+   return records;
+}
+
+unsigned long QTableMerger::getEntries() const
+{
+   return entries;
+}
+
+unsigned long QTableMerger::getConflicts() const
+{
+   return conflicts;
+}
@@ -0,0 +1,60 @@
+#ifndef _QTABLEMERGER_
+#define _QTABLEMERGER_
+
+#include "SortedQTable.hpp"
+#include "QLearner.hpp"
+#include <memory>
+#include <vector>
+
+/*
+ * What the merged entry of a <state, action> pair found in several files is.
+*/
+enum MergeRule
+{
+   MERGE_MAX,           /* the highest q-value */
+   MERGE_VISIT_AVERAGE, /* the mean of the q-values weighted by their visit counts */
+   MERGE_LATEST         /* the q-value of the most recently modified file */
+};
+
+/*
+ * Combines the sorted 'Q' table files (see SortedQTable) of several training runs into one: a k-way merge that streams
+ * over the inputs in <state, action> order and writes the merged table & its 'policy' in the same pass. Memory stays at
+ * one cursor per input plus the best entry of the current state, whatever the size of the tables. The visit counts of a
+ * pair are summed up with every rule.
+*/
+class QTableMerger
+{
+   struct Input
+   {
+      std::unique_ptr<SortedQTable> table;
+      std::string path;
+      int64_t mtime; /* ns, for MERGE_LATEST */
+   };
+
+   std::vector<Input> inputs;
+   MergeRule rule;
+   unsigned long records;   /* read from the inputs */
+   unsigned long entries;   /* written */
+   unsigned long conflicts; /* pairs found in more than one input */
+
+public:
+
+   QTableMerger(MergeRule rule = MERGE_MAX);
+
+   bool addInput(const std::string& path);
+
+   bool merge(const std::string& qtablePath, const std::string& policyPath);
+
+   size_t getInputs() const;
+
+   unsigned long getRecords() const;
+
+   unsigned long getEntries() const;
+
+   unsigned long getConflicts() const;
+
+   static bool parseRule(const std::string& name, MergeRule& rule);
+
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include "SharedQTable.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+static const char SHARED_MAGIC[4] = {'Q', 'L', 'S', 'H'};
+
+/*
+ * Start of the region, followed by the entries of the 16 states (see getKeys(..)). The atomics are used by several
+ * processes at once, so they have to be lock free (address free).
+*/
+struct SharedHeader
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t capacity; /* entries per state, a power of 2 */
+   uint32_t slots;    /* index slots per state */
+   uint64_t length;   /* of the whole region */
+   std::atomic<uint32_t> ready; /* set once the creator initialized & loaded the region, see setReady() */
+   std::atomic<int32_t> creator; /* pid */
+   std::atomic<int32_t> saver; /* pid of the process that saves the table, 0 = none, see claimSaver() */
+   std::atomic<uint32_t> attached;
+   std::atomic<uint64_t> dropped; /* inserts into a full state */
+   std::atomic<uint32_t> size[16];
+   pthread_mutex_t lock[16]; /* serializes the inserts into a state, process shared & robust */
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "the shared 'Q' table needs lock free atomics");
+static_assert(std::atomic_ref<qvalue_t>::is_always_lock_free, "the shared 'Q' table needs lock free q-values");
+
+static size_t getHeaderSize()
+{
+   return (sizeof(SharedHeader) + 63) / 64 * 64;
+}
+
+/*
+ * Bytes per state: keys, then index, q-values & visit counts, each array 8 byte aligned.
+*/
+static size_t getStateBytes(uint32_t capacity, uint32_t slots)
+{
+   size_t values = (capacity * sizeof(qvalue_t) + 7) / 8 * 8;
+   return capacity * sizeof(uint64_t) + slots * sizeof(uint32_t) + values + capacity * sizeof(uint32_t);
+}
+
+/*
+ * How long open(..) waits for the creator to fill the table (see setReady()), loading a big q-table takes seconds.
+*/
+static const int READY_TIMEOUT_MS = 60000;
+
+/*
+ * A region that has no creator pid after this long was left behind by a creator that died right after creating it.
+*/
+static const int CREATOR_TIMEOUT_MS = 1000;
+
+static const uint32_t SHARED_VERSION = 3;
+
+static bool isAlive(int32_t pid)
+{
+   return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static uint32_t getSlot(uint64_t action, uint32_t slots)
+{
+   return (uint32_t) ((action * 0x9e3779b97f4a7c15ULL) >> 32) & (slots - 1);
+}
+
+SharedQTable::SharedQTable(): header(NULL), length(0), created(false) {}
+
+SharedQTable::~SharedQTable()
+{
+   close();
+}
+
+uint64_t* SharedQTable::getKeys(int state) const
+{
+   return (uint64_t*) ((char*) header + getHeaderSize() + state * getStateBytes(header->capacity, header->slots));
+}
+
+uint32_t* SharedQTable::getIndex(int state) const
+{
+   return (uint32_t*) (getKeys(state) + header->capacity);
+}
+
+qvalue_t* SharedQTable::getValueColumn(int state) const
+{
+   return (qvalue_t*) (getIndex(state) + header->slots);
+}
+
+uint32_t* SharedQTable::getVisitColumn(int state) const
+{
+   return (uint32_t*) ((char*) getValueColumn(state) + (header->capacity * sizeof(qvalue_t) + 7) / 8 * 8);
+}
+
+/*
+ * Attaches to the shared memory object 'name' (e.g. "/qlearner"), creating it with room for 'capacity' entries per state
+ * (rounded up to a power of 2) if it does not exist yet. The capacity of an existing table stays as it is.
+ * The other processes only attach once the creator called setReady() (after loading the table), so that nothing they
+ * insert gets in the way of the loaded values; they wait up to READY_TIMEOUT_MS for it (ETIMEDOUT otherwise). If the
+ * creator died before that, the object is removed and created anew.
+*/
+bool SharedQTable::open(const std::string& name, uint32_t capacity)
+{
+   close();
+   return attach(name, capacity, true);
+}
+
+/*
+ * open(..), 'retry' once after removing a stale object.
+*/
+bool SharedQTable::attach(const std::string& name, uint32_t capacity, bool retry)
+{
+   int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+   created = fd >= 0;
+   uint32_t entries = 1;
+   if(created)
+   {
+      while(entries < capacity && entries < (1u << 30))
+         entries <<= 1;
+      length = getHeaderSize() + 16 * getStateBytes(entries, 2 * entries);
+      if(ftruncate(fd, length) != 0)
+      {
+         ::close(fd);
+         shm_unlink(name.c_str());
+         return false;
+      }
+   }
+   else
+   {
+      if(errno != EEXIST || (fd = shm_open(name.c_str(), O_RDWR, 0600)) < 0)
+         return false;
+      /*
+       * The creator may still be sizing it.
+      */
+      struct stat st;
+      for(int tries = 0; fstat(fd, &st) == 0 && (size_t) st.st_size < getHeaderSize() && tries < CREATOR_TIMEOUT_MS; tries++)
+         usleep(1000);
+      length = fstat(fd, &st) == 0 ? st.st_size : 0;
+      if(length < getHeaderSize())
+      {
+         ::close(fd);
+         if(retry && shm_unlink(name.c_str()) == 0)
+            return attach(name, capacity, false);
+         errno = EINVAL;
+         return false;
+      }
+   }
+   void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if(map == MAP_FAILED)
+   {
+      if(created)
+         shm_unlink(name.c_str());
+      return false;
+   }
+   header = (SharedHeader*) map;
+   if(created)
+   {
+      /*
+       * The object comes zero filled: empty index slots, sizes.
+      */
+      new (header) SharedHeader();
+      memcpy(header->magic, SHARED_MAGIC, sizeof(header->magic));
+      header->version = SHARED_VERSION;
+      header->capacity = entries;
+      header->slots = 2 * header->capacity;
+      header->length = length;
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init(&attr);
+      pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+      pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+      for(int s = 0; s < 16; s++)
+         pthread_mutex_init(&header->lock[s], &attr);
+      pthread_mutexattr_destroy(&attr);
+      header->creator.store(getpid());
+   }
+   else
+   {
+      bool stale = false;
+      for(int tries = 0; header->ready.load(std::memory_order_acquire) == 0 && tries < READY_TIMEOUT_MS && !stale; tries++)
+      {
+         int32_t creator = header->creator.load();
+         stale = creator ? !isAlive(creator) : tries >= CREATOR_TIMEOUT_MS;
+         if(!stale)
+            usleep(1000);
+      }
+      bool ready = header->ready.load(std::memory_order_acquire) != 0;
+      if(!ready || memcmp(header->magic, SHARED_MAGIC, sizeof(header->magic)) != 0 || header->version != SHARED_VERSION ||
+         header->length != length || (header->slots & (header->slots - 1)) != 0)
+      {
+         munmap(map, length);
+         header = NULL;
+         if(!ready && stale && retry && shm_unlink(name.c_str()) == 0)
+            return attach(name, capacity, false);
+         errno = ready ? EINVAL : ETIMEDOUT;
+         return false;
+      }
+   }
+   header->attached.fetch_add(1);
+   this->name = name;
+   claimSaver(); /* the first process keeps the role as long as it is attached */
+   return true;
+}
+
+/*
+ * Detaches and hands the saver role on. The table stays for the other processes; the last one removes it (save it first).
+*/
+void SharedQTable::close()
+{
+   if(!header)
+      return;
+   int32_t self = getpid();
+   header->saver.compare_exchange_strong(self, 0);
+   bool last = header->attached.fetch_sub(1) == 1;
+   munmap(header, length);
+   header = NULL;
+   length = 0;
+   if(last)
+      remove(name);
+}
+
+/*
+ * True if open(..) created the table (it is empty then).
+*/
+bool SharedQTable::isCreator() const
+{
+   return created;
+}
+
+/*
+ * The creator is done filling the table, the other processes can attach now (see open(..)).
+*/
+void SharedQTable::setReady()
+{
+   header->ready.store(1, std::memory_order_release);
+}
+
+/*
+ * True if this process saves the table: it is the saver already, or there is none (anymore, the saver detached or died)
+ * and it takes over. Only the saver writes the table to disk, so that the processes do not write the same files at once.
+*/
+bool SharedQTable::claimSaver() const
+{
+   int32_t self = getpid();
+   int32_t holder = header->saver.load();
+   while(holder != self)
+   {
+      if(holder != 0 && isAlive(holder))
+         return false;
+      if(header->saver.compare_exchange_weak(holder, self))
+         break;
+   }
+   return true;
+}
+
+/*
+ * Takes the insert lock of a state. If its last owner died holding it, the insert it was doing is either complete but for
+ * the state size (the index slot is stored before the size) or invisible, so the size is set from the index and the lock
+ * is made usable again.
+*/
+bool SharedQTable::lock(int state)
+{
+   int error = pthread_mutex_lock(&header->lock[state]);
+   if(error == EOWNERDEAD)
+   {
+      const uint32_t* index = getIndex(state);
+      uint32_t n = header->size[state].load(std::memory_order_relaxed);
+      for(uint32_t slot = 0; slot < header->slots; slot++)
+         n = std::max(n, index[slot]);
+      header->size[state].store(n, std::memory_order_release);
+      error = pthread_mutex_consistent(&header->lock[state]);
+   }
+   if(error == 0)
+      return true;
+   errno = error;
+   return false;
+}
+
+/*
+ * Position of Q(state, action), -1 if it is not in the table.
+*/
+long SharedQTable::find(FeetState state, uint64_t action) const
+{
+   const uint64_t* keys = getKeys(state);
+   uint32_t* index = getIndex(state);
+   uint32_t mask = header->slots - 1;
+   for(uint32_t slot = getSlot(action, header->slots); ; slot = (slot + 1) & mask)
+   {
+      uint32_t entry = std::atomic_ref<uint32_t>(index[slot]).load(std::memory_order_acquire);
+      if(entry == 0)
+         return -1;
+      if(keys[entry - 1] == action)
+         return entry - 1;
+   }
+}
+
+/*
+ * Appends Q(state, action) = qvalue unless another process did so first; its position, -1 if the state is full (or its
+ * lock is broken).
+*/
+long SharedQTable::insert(FeetState state, uint64_t action, double qvalue)
+{
+   if(!lock(state))
+   {
+      header->dropped.fetch_add(1, std::memory_order_relaxed);
+      return -1;
+   }
+   uint64_t* keys = getKeys(state);
+   uint32_t* index = getIndex(state);
+   uint32_t mask = header->slots - 1;
+   uint32_t slot = getSlot(action, header->slots);
+   long pos = -1;
+   for(; index[slot] != 0; slot = (slot + 1) & mask)
+   {
+      if(keys[index[slot] - 1] == action)
+      {
+         pos = index[slot] - 1;
+         break;
+      }
+   }
+   uint32_t n = header->size[state].load(std::memory_order_relaxed);
+   if(pos < 0 && n < header->capacity)
+   {
+      keys[n] = action;
+      std::atomic_ref<qvalue_t>(getValueColumn(state)[n]).store(quantize(qvalue), std::memory_order_relaxed);
+      std::atomic_ref<uint32_t>(getVisitColumn(state)[n]).store(0, std::memory_order_relaxed);
+      std::atomic_ref<uint32_t>(index[slot]).store(n + 1, std::memory_order_release);
+      header->size[state].store(n + 1, std::memory_order_release);
+      pos = n;
+   }
+   else if(pos < 0)
+      header->dropped.fetch_add(1, std::memory_order_relaxed);
+   pthread_mutex_unlock(&header->lock[state]);
+   return pos;
+}
+
+/*
+ * Stores the new q-value and counts the visit.
+*/
+void SharedQTable::update(FeetState state, size_t pos, double qvalue)
+{
+   std::atomic_ref<qvalue_t>(getValueColumn(state)[pos]).store(quantize(qvalue), std::memory_order_relaxed);
+   std::atomic_ref<uint32_t> visits(getVisitColumn(state)[pos]);
+   if(visits.load(std::memory_order_relaxed) < UINT32_MAX)
+      visits.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+ * The entries 0 .. getStateSize(..) - 1 are complete.
+*/
+size_t SharedQTable::getStateSize(FeetState state) const
+{
+   return header->size[state].load(std::memory_order_acquire);
+}
+
+size_t SharedQTable::size() const
+{
+   size_t total = 0;
+   for(int s = 0; s < 16; s++)
+      total += getStateSize((FeetState) s);
+   return total;
+}
+
+uint64_t SharedQTable::getKey(FeetState state, size_t pos) const
+{
+   return getKeys(state)[pos];
+}
+
+qvalue_t SharedQTable::getValue(FeetState state, size_t pos) const
+{
+   return std::atomic_ref<qvalue_t>(getValueColumn(state)[pos]).load(std::memory_order_relaxed);
+}
+
+/*
+ * The q-value column of a state; other processes keep writing it, use getValue(..) to read single entries.
+*/
+const qvalue_t* SharedQTable::getValues(FeetState state) const
+{
+   return getValueColumn(state);
+}
+
+uint32_t SharedQTable::getVisits(FeetState state, size_t pos) const
+{
+   return std::atomic_ref<uint32_t>(getVisitColumn(state)[pos]).load(std::memory_order_relaxed);
+}
+
+/*
+ * Position of the (first) max q-value of a state, -1 if nothing was tried in that state.
+*/
+long SharedQTable::argmax(FeetState state) const
+{
+   size_t n = getStateSize(state);
+   long best = -1;
+   qvalue_t max = 0;
+   for(size_t pos = 0; pos < n; pos++)
+   {
+      qvalue_t value = getValue(state, pos);
+      if(best < 0 || value > max)
+      {
+         max = value;
+         best = pos;
+      }
+   }
+   return best;
+}
+
+uint32_t SharedQTable::getCapacity() const
+{
+   return header->capacity;
+}
+
+/*
+ * # of processes (well, SharedQTables) attached right now.
+*/
+uint32_t SharedQTable::getAttached() const
+{
+   return header->attached.load();
+}
+
+uint64_t SharedQTable::getDropped() const
+{
+   return header->dropped.load(std::memory_order_relaxed);
+}
+
+/*
+ * Removes the name, the memory goes away with the last process attached.
+*/
+bool SharedQTable::remove(const std::string& name)
+{
+   return shm_unlink(name.c_str()) == 0;
+}
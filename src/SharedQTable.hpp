@@ -0,0 +1,93 @@
+#ifndef _SHAREDQTABLE_
+#define _SHAREDQTABLE_
+
+#include "QStore.hpp"
+#include <string>
+
+struct SharedHeader;
+
+/*
+ * 'Q' table living in a POSIX shared memory object (shm_open(..) + mmap(..)), so that several learner processes on one host
+ * (simulators, the QLearnerNode controller, ...) work on one table instead of a copy each. Attaching maps the region, the
+ * table is never copied or serialized; detaching (close(), or the process ending) leaves it to the others. The object
+ * stays until remove(..) (or a reboot).
+ * Fixed capacity per FeetState, set by whoever creates the region. Every state has a dense, append only array of entries
+ * (key, q-value, visit count; positions as in QStore) and an open-addressing index over it (linear probing, 2 slots per
+ * entry, 0 = empty else position + 1). Lookups and updates are lock free: q-values and visit counts are atomic words, the
+ * last writer wins. Inserting takes a per-state (process shared, robust) mutex for the few instructions it takes to append
+ * the entry and publish it (index slot, then state size, both with release semantics); a process killed while holding it
+ * does not block the others. Once a state is full, further inserts are dropped and counted.
+ * One attached process at a time is the saver (claimSaver()), the one that writes the table to disk; the role passes on
+ * when it detaches or dies, so whoever is attached last always gets it. The last process to detach removes the object, a
+ * stale one (its creator died before it was ready) is replaced by the next open(..).
+*/
+class SharedQTable
+{
+   SharedHeader* header;
+   size_t length; /* of the mapping */
+   bool created;
+   std::string name;
+
+   bool attach(const std::string& name, uint32_t capacity, bool retry);
+
+   uint64_t* getKeys(int state) const;
+
+   uint32_t* getIndex(int state) const;
+
+   qvalue_t* getValueColumn(int state) const;
+
+   uint32_t* getVisitColumn(int state) const;
+
+   bool lock(int state);
+
+public:
+
+   SharedQTable();
+
+   ~SharedQTable();
+
+   SharedQTable(const SharedQTable&) = delete;
+
+   SharedQTable& operator=(const SharedQTable&) = delete;
+
+   bool open(const std::string& name, uint32_t capacity);
+
+   void close();
+
+   bool isCreator() const;
+
+   void setReady();
+
+   bool claimSaver() const;
+
+   long find(FeetState state, uint64_t action) const;
+
+   long insert(FeetState state, uint64_t action, double qvalue);
+
+   void update(FeetState state, size_t pos, double qvalue);
+
+   size_t getStateSize(FeetState state) const;
+
+   size_t size() const;
+
+   uint64_t getKey(FeetState state, size_t pos) const;
+
+   qvalue_t getValue(FeetState state, size_t pos) const;
+
+   const qvalue_t* getValues(FeetState state) const;
+
+   uint32_t getVisits(FeetState state, size_t pos) const;
+
+   long argmax(FeetState state) const;
+
+   uint32_t getCapacity() const;
+
+   uint32_t getAttached() const;
+
+   uint64_t getDropped() const;
+
+   static bool remove(const std::string& name);
+
+};
+
+#endif
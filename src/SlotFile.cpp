@@ -0,0 +1,217 @@
+#include "SlotFile.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+static const char SLOTFILE_MAGIC[4] = {'Q', 'L', 'S', 'L'};
+
+SlotFile::SlotFile(): fd(-1), slots(0), records(0), writes(0) {}
+
+SlotFile::~SlotFile()
+{
+   close();
+}
+
+void SlotFile::close()
+{
+   if(fd >= 0)
+      ::close(fd);
+   fd = -1;
+   slots = 0;
+   freeslots.clear();
+}
+
+static bool writeAll(int fd, const void* data, size_t size, off_t offset)
+{
+   const char* p = (const char*) data;
+   while(size > 0)
+   {
+      ssize_t n = pwrite(fd, p, size, offset);
+      if(n < 0 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         return false;
+      p += n;
+      size -= n;
+      offset += n;
+   }
+   return true;
+}
+
+static bool readAll(int fd, void* data, size_t size, off_t offset)
+{
+   char* p = (char*) data;
+   while(size > 0)
+   {
+      ssize_t n = pread(fd, p, size, offset);
+      if(n < 0 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         return false;
+      p += n;
+      size -= n;
+      offset += n;
+   }
+   return true;
+}
+
+/*
+ * Loads the entries of the slot file 'path' into the (empty) 'table', or creates the file, and turns on the dirty tracking
+ * of 'table' for checkpoint(..).
+*/
+bool SlotFile::open(const std::string& path, QStore& table)
+{
+   close();
+   this->path = path;
+   fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+   if(fd < 0)
+      return false;
+   struct stat st;
+   if(fstat(fd, &st) != 0)
+   {
+      close();
+      return false;
+   }
+   QFileHeader header;
+   if(st.st_size == 0)
+   {
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, SLOTFILE_MAGIC, sizeof(header.magic));
+      header.version = 1;
+      header.recordsize = sizeof(QRecord);
+      if(!writeAll(fd, &header, sizeof(header), 0))
+      {
+         close();
+         return false;
+      }
+   }
+   else
+   {
+      if(!readAll(fd, &header, sizeof(header), 0) || memcmp(header.magic, SLOTFILE_MAGIC, sizeof(header.magic)) != 0 ||
+         header.recordsize != sizeof(QRecord))
+      {
+         close();
+         errno = EINVAL;
+         return false;
+      }
+      slots = (st.st_size - sizeof(QFileHeader)) / sizeof(QRecord);
+      std::vector<QRecord> chunk(4096);
+      for(uint32_t first = 0; first < slots; first += chunk.size())
+      {
+         size_t n = std::min<size_t>(chunk.size(), slots - first);
+         if(!readAll(fd, chunk.data(), n * sizeof(QRecord), sizeof(QFileHeader) + ((off_t) first * sizeof(QRecord))))
+         {
+            close();
+            return false;
+         }
+         for(size_t i = 0; i < n; i++)
+         {
+            if(chunk[i].state >= 16)
+               freeslots.push_back(first + i);
+            else
+               table.insertSlot((FeetState) chunk[i].state, chunk[i].action, chunk[i].qvalue, chunk[i].visits, first + i);
+         }
+      }
+   }
+   table.setDirtyTracking(DIRTY_SLOTS, true);
+   return true;
+}
+
+/*
+ * The records of 'run', from slot 'first' on, with a single write.
+*/
+bool SlotFile::writeRun(uint32_t first)
+{
+   writes++;
+   records += run.size();
+   return writeAll(fd, run.data(), run.size() * sizeof(QRecord), sizeof(QFileHeader) + ((off_t) first * sizeof(QRecord)));
+}
+
+/*
+ * Writes the entries changed since the last checkpoint (see QStore::setDirtyTracking(..)) to their slots, new entries to a
+ * free or a new slot, frees the slots of evicted entries; fdatasyncs if 'sync'. Cost: O(changed entries).
+*/
+bool SlotFile::checkpoint(QStore& table, bool sync)
+{
+   if(fd < 0)
+      return false;
+   pending.clear();
+   QRecord freed;
+   memset(&freed, 0, sizeof(freed));
+   freed.state = QRECORD_FREE;
+   const std::vector<uint32_t>& evicted = table.getFreedSlots();
+   for(size_t i = 0; i < evicted.size(); i++)
+   {
+      freeslots.push_back(evicted[i]);
+      pending.push_back(std::make_pair(evicted[i], freed));
+   }
+   FeetState state;
+   size_t pos;
+   for(size_t i = 0; i < table.getDirtySize(DIRTY_SLOTS); i++)
+   {
+      if(!table.getDirty(DIRTY_SLOTS, i, state, pos))
+         continue;
+      uint32_t slot = table.getSlot(state, pos);
+      if(slot == NO_SLOT)
+      {
+         if(!freeslots.empty())
+         {
+            slot = freeslots.back();
+            freeslots.pop_back();
+         }
+         else
+            slot = slots++;
+         table.setSlot(state, pos, slot);
+      }
+      pending.push_back(std::make_pair(slot, makeQRecord(table, state, pos)));
+   }
+   /*
+    * In slot order, a slot freed & reused by the same checkpoint gets the new entry (the later one).
+   */
+   std::stable_sort(pending.begin(), pending.end(),
+                    [](const std::pair<uint32_t, QRecord>& a, const std::pair<uint32_t, QRecord>& b) { return a.first < b.first; });
+   run.clear();
+   uint32_t first = 0;
+   for(size_t i = 0; i < pending.size(); i++)
+   {
+      if(i + 1 < pending.size() && pending[i + 1].first == pending[i].first)
+         continue;
+      if(!run.empty() && pending[i].first != first + run.size())
+      {
+         if(!writeRun(first))
+            return false;
+         run.clear();
+      }
+      if(run.empty())
+         first = pending[i].first;
+      run.push_back(pending[i].second);
+   }
+   if(!run.empty() && !writeRun(first))
+      return false;
+   table.clearDirty(DIRTY_SLOTS);
+   return !sync || fdatasync(fd) == 0;
+}
+
+uint32_t SlotFile::getSlots() const
+{
+   return slots;
+}
+
+/*
+ * Records written by all checkpoints so far.
+*/
+unsigned long SlotFile::getRecordsWritten() const
+{
+   return records;
+}
+
+/*
+ * Write calls of all checkpoints so far (a run of consecutive slots is one call).
+*/
+unsigned long SlotFile::getWrites() const
+{
+   return writes;
+}
@@ -0,0 +1,46 @@
+#ifndef _SLOTFILE_
+#define _SLOTFILE_
+
+#include "QRecord.hpp"
+#include <string>
+#include <vector>
+
+/*
+ * 'Q' table file with a stable, fixed-width slot per entry (QRecord), updated in place: checkpoint(..) writes only the
+ * entries the QStore marked dirty since the last checkpoint (with positioned writes, consecutive slots in one go), new
+ * entries get a slot appended at the end (or the slot of an evicted one). So a checkpoint costs O(changed entries) instead
+ * of rewriting the whole table like QLearner::saveQTable(..).
+*/
+class SlotFile
+{
+   int fd;
+   std::string path;
+   uint32_t slots; /* in the file */
+   std::vector<uint32_t> freeslots;
+   std::vector<std::pair<uint32_t, QRecord>> pending; /* <slot, record> of the current checkpoint */
+   std::vector<QRecord> run; /* consecutive records of 'pending' */
+   unsigned long records, writes; /* written so far, records & write calls */
+
+   bool writeRun(uint32_t first);
+
+public:
+
+   SlotFile();
+
+   ~SlotFile();
+
+   bool open(const std::string& path, QStore& table);
+
+   bool checkpoint(QStore& table, bool sync);
+
+   void close();
+
+   uint32_t getSlots() const;
+
+   unsigned long getRecordsWritten() const;
+
+   unsigned long getWrites() const;
+
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "SortedQTable.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdio.h>
+#include <algorithm>
+
+static const char SORTED_MAGIC[4] = {'Q', 'L', 'S', 'O'};
+
+SortedQTable::SortedQTable(): fd(-1), map(MAP_FAILED), mapsize(0), records(NULL)
+{
+   memset(&index, 0, sizeof(index));
+}
+
+SortedQTable::~SortedQTable()
+{
+   close();
+}
+
+void SortedQTable::close()
+{
+   if(map != MAP_FAILED)
+      munmap(map, mapsize);
+   if(fd >= 0)
+      ::close(fd);
+   map = MAP_FAILED;
+   fd = -1;
+   records = NULL;
+   memset(&index, 0, sizeof(index));
+}
+
+/*
+ * Maps the file and checks the header & index, no record is read yet. 'sequential' if it is going to be read front to back
+ * (e.g. merged) rather than state by state.
+*/
+bool SortedQTable::open(const std::string& path, bool sequential)
+{
+   close();
+   fd = ::open(path.c_str(), O_RDONLY);
+   if(fd < 0)
+      return false;
+   struct stat st;
+   if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(QFileHeader) + sizeof(SortedIndex))
+   {
+      close();
+      errno = EINVAL;
+      return false;
+   }
+   mapsize = st.st_size;
+   map = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+   if(map == MAP_FAILED)
+   {
+      close();
+      return false;
+   }
+   madvise(map, mapsize, sequential ? MADV_SEQUENTIAL : MADV_RANDOM); /* else only the visited states are read */
+   const QFileHeader* header = (const QFileHeader*) map;
+   memcpy(&index, (const char*) map + sizeof(QFileHeader), sizeof(index));
+   size_t available = (mapsize - sizeof(QFileHeader) - sizeof(SortedIndex)) / sizeof(QRecord);
+   bool valid = memcmp(header->magic, SORTED_MAGIC, sizeof(header->magic)) == 0 && header->recordsize == sizeof(QRecord) &&
+                index.first[0] == 0 && index.first[16] <= available;
+   for(int s = 0; valid && s < 16; s++)
+      valid = index.first[s] <= index.first[s + 1];
+   if(!valid)
+   {
+      close();
+      errno = EINVAL;
+      return false;
+   }
+   records = (const QRecord*) ((const char*) map + sizeof(QFileHeader) + sizeof(SortedIndex));
+   return true;
+}
+
+size_t SortedQTable::size() const
+{
+   return index.first[16];
+}
+
+size_t SortedQTable::getStateSize(FeetState state) const
+{
+   return index.first[state + 1] - index.first[state];
+}
+
+/*
+ * The getStateSize(..) records of 'state', sorted by action.
+*/
+const QRecord* SortedQTable::getState(FeetState state) const
+{
+   return records + index.first[state];
+}
+
+/*
+ * Drops the pages of the records from .. to - 1 out of the memory of the process (they are read again from the file if
+ * need be), so that streaming over the file keeps a constant resident size.
+*/
+void SortedQTable::release(const QRecord* from, const QRecord* to) const
+{
+   size_t page = sysconf(_SC_PAGESIZE);
+   size_t begin = ((const char*) from - (const char*) map) / page * page;
+   size_t end = ((const char*) to - (const char*) map) / page * page;
+   if(end > begin)
+      madvise((char*) map + begin, end - begin, MADV_DONTNEED);
+}
+
+/*
+ * Writes 'table' sorted by <state, action> to 'path'. The states 'table' did not page in yet are copied over from its file
+ * as they are.
+*/
+bool SortedQTable::write(const QStore& table, const std::string& path)
+{
+   SortedQTableWriter writer;
+   if(!writer.open(path))
+      return false;
+   std::vector<QRecord> sorted;
+   for(int s = 0; s < 16; s++)
+   {
+      const SortedQTable* backing = table.getBacking((FeetState) s);
+      if(backing)
+      {
+         const QRecord* records = backing->getState((FeetState) s);
+         for(size_t i = 0; i < backing->getStateSize((FeetState) s); i++)
+            writer.add(records[i]);
+         continue;
+      }
+      sorted.clear();
+      for(size_t pos = 0; pos < table.getStateSize((FeetState) s); pos++)
+         sorted.push_back(makeQRecord(table, (FeetState) s, pos));
+      std::sort(sorted.begin(), sorted.end(), [](const QRecord& a, const QRecord& b) { return a.action < b.action; });
+      for(size_t i = 0; i < sorted.size(); i++)
+         writer.add(sorted[i]);
+   }
+   return writer.close();
+}
+
+SortedQTableWriter::SortedQTableWriter(): file(NULL), count(0), last(0), lastaction(0), ok(false) {}
+
+/*
+ * Without close() the temporary file is dropped & 'path' stays as it was.
+*/
+SortedQTableWriter::~SortedQTableWriter()
+{
+   if(file)
+   {
+      fclose(file);
+      unlink((path + ".tmp").c_str());
+   }
+}
+
+bool SortedQTableWriter::open(const std::string& path)
+{
+   this->path = path;
+   file = fopen((path + ".tmp").c_str(), "w");
+   if(!file)
+      return false;
+   memset(&index, 0, sizeof(index));
+   count = 0;
+   last = 0;
+   lastaction = 0;
+   QFileHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, SORTED_MAGIC, sizeof(header.magic));
+   header.version = 1;
+   header.recordsize = sizeof(QRecord);
+   ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&index, sizeof(index), 1, file) == 1; /* index: see close() */
+   return ok;
+}
+
+/*
+ * False (& the file is not going to be written) if 'record' is out of order or a duplicate.
+*/
+bool SortedQTableWriter::add(const QRecord& record)
+{
+   if(!file || record.state >= 16 || record.state < last || (count > 0 && record.state == last && record.action <= lastaction))
+   {
+      ok = false;
+      errno = EINVAL;
+      return false;
+   }
+   while(last < record.state)
+      index.first[++last] = count;
+   lastaction = record.action;
+   count++;
+   ok = ok && fwrite(&record, sizeof(record), 1, file) == 1;
+   return ok;
+}
+
+/*
+ * Fills in the index and moves the file in place, false if anything went wrong on the way.
+*/
+bool SortedQTableWriter::close()
+{
+   if(!file)
+      return false;
+   while(last < 16)
+      index.first[++last] = count;
+   ok = ok && fseek(file, sizeof(QFileHeader), SEEK_SET) == 0 && fwrite(&index, sizeof(index), 1, file) == 1;
+   ok = (fclose(file) == 0) && ok;
+   file = NULL;
+   std::string temp = path + ".tmp";
+   if(!ok || rename(temp.c_str(), path.c_str()) != 0)
+   {
+      unlink(temp.c_str());
+      return false;
+   }
+   return true;
+}
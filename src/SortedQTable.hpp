@@ -0,0 +1,87 @@
+#ifndef _SORTEDQTABLE_
+#define _SORTEDQTABLE_
+
+#include "QRecord.hpp"
+#include <stdio.h>
+#include <string>
+
+/*
+ * Per-state index of a sorted 'Q' table file: the records of FeetState s are first[s] .. first[s + 1] - 1.
+*/
+struct SortedIndex
+{
+   uint32_t first[17];
+   uint32_t reserved;
+};
+
+static_assert((sizeof(QFileHeader) + sizeof(SortedIndex)) % 8 == 0, "the records are meant to stay 8 byte aligned");
+
+/*
+ * Read-only, memory mapped 'Q' table file sorted by <state, action> ("QLSO": QFileHeader, SortedIndex, QRecords). open(..)
+ * only maps the file, a state's records are contiguous and are read (paged in by the kernel) when they are first used, see
+ * QStore::attach(..): startup time does not depend on the table size and the resident memory follows the states actually
+ * visited. Being sorted, such files can also be merged in a streaming fashion.
+*/
+class SortedQTable
+{
+   int fd;
+   void* map;
+   size_t mapsize;
+   SortedIndex index;
+   const QRecord* records;
+
+public:
+
+   SortedQTable();
+
+   ~SortedQTable();
+
+   SortedQTable(const SortedQTable&) = delete;
+
+   SortedQTable& operator=(const SortedQTable&) = delete;
+
+   bool open(const std::string& path, bool sequential = false);
+
+   void close();
+
+   size_t size() const;
+
+   size_t getStateSize(FeetState state) const;
+
+   const QRecord* getState(FeetState state) const;
+
+   void release(const QRecord* from, const QRecord* to) const;
+
+   static bool write(const QStore& table, const std::string& path);
+
+};
+
+/*
+ * Streams records, in <state, action> order, into a sorted 'Q' table file: the index is filled in by close(). Writes to a
+ * temporary file that replaces 'path' on close(), so that a table still mapped from 'path' keeps its (old) file.
+*/
+class SortedQTableWriter
+{
+   FILE* file;
+   std::string path;
+   SortedIndex index;
+   size_t count;
+   int last; /* state of the last record */
+   uint64_t lastaction;
+   bool ok;
+
+public:
+
+   SortedQTableWriter();
+
+   ~SortedQTableWriter();
+
+   bool open(const std::string& path);
+
+   bool add(const QRecord& record);
+
+   bool close();
+
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "SweepRunner.hpp"
+#include <thread>
+#include <atomic>
+
+SweepSpec::SweepSpec(): samples(0), repeats(1), threads(0), seed(1)
+{
+   train.episodes = 20000;
+}
+
+/*
+ * The rest of the line as a list of values, false unless it is one (at least one value, nothing else).
+*/
+template <typename T>
+static bool readValues(std::stringstream& linestream, std::vector<T>& values)
+{
+   values.clear();
+   T value;
+   while(linestream >> value)
+      values.push_back(value);
+   return !values.empty() && linestream.eof();
+}
+
+/*
+ * The rest of the line as a single value, false unless it is one.
+*/
+template <typename T>
+static bool readValue(std::stringstream& linestream, T& value)
+{
+   return (linestream >> value) && (linestream >> std::ws).eof();
+}
+
+bool SweepSpec::load(const std::string& path)
+{
+   std::ifstream file(path.c_str());
+   if(!file)
+      return false;
+   std::string line;
+   unsigned int linenumber = 0;
+   while(std::getline(file, line))
+   {
+      linenumber++;
+      line = line.substr(0, line.find('#'));
+      std::stringstream linestream(line);
+      std::string name;
+      if(!(linestream >> name))
+         continue;
+      bool ok;
+      if(name == "epsilon")
+         ok = readValues(linestream, epsilon);
+      else if(name == "alpha")
+         ok = readValues(linestream, alpha);
+      else if(name == "gamma")
+         ok = readValues(linestream, gamma);
+      else if(name == "tsprate")
+         ok = readValues(linestream, tsprate);
+      else if(name == "fallthreshold")
+         ok = readValues(linestream, fallthreshold);
+      else if(name == "samples")
+         ok = readValue(linestream, samples);
+      else if(name == "repeats")
+         ok = readValue(linestream, repeats);
+      else if(name == "threads")
+         ok = readValue(linestream, threads);
+      else if(name == "seed")
+         ok = readValue(linestream, seed);
+      else if(name == "episodes")
+         ok = readValue(linestream, train.episodes);
+      else if(name == "seconds")
+         ok = readValue(linestream, train.seconds);
+      else if(name == "window")
+         ok = readValue(linestream, train.window);
+      else if(name == "tolerance")
+         ok = readValue(linestream, train.tolerance);
+      else
+      {
+         ERROR("%s:%u: unknown setting '%s'\n", path.c_str(), linenumber, name.c_str());
+         return false;
+      }
+      if(!ok)
+      {
+         ERROR("%s:%u: invalid value for '%s'\n", path.c_str(), linenumber, name.c_str());
+         return false;
+      }
+   }
+   if(train.episodes == 0 && train.seconds <= 0.0)
+   {
+      ERROR("%s: every run needs a limit ('episodes' or 'seconds')\n", path.c_str());
+      return false;
+   }
+   return true;
+}
+
+SweepRunner::SweepRunner(const SweepSpec& spec): spec(spec) {}
+
+template <typename T>
+static std::vector<T> orDefault(const std::vector<T>& values, T fallback)
+{
+   return values.empty() ? std::vector<T>(1, fallback) : values;
+}
+
+template <typename T>
+static T draw(const std::vector<T>& values, std::mt19937_64& rng)
+{
+   T min = *std::min_element(values.begin(), values.end());
+   T max = *std::max_element(values.begin(), values.end());
+   if constexpr (std::is_integral<T>::value)
+      return std::uniform_int_distribution<T>(min, max)(rng);
+   else
+      return std::uniform_real_distribution<T>(min, max)(rng);
+}
+
+/*
+ * The full grid, or 'samples' random configurations (reproducible from 'seed').
+*/
+std::vector<LearnerParams> SweepRunner::getConfigurations() const
+{
+   LearnerParams defaults;
+   std::vector<float> epsilon = orDefault(spec.epsilon, defaults.epsilon);
+   std::vector<float> alpha = orDefault(spec.alpha, defaults.alpha);
+   std::vector<float> gamma = orDefault(spec.gamma, defaults.gamma);
+   std::vector<float> tsprate = orDefault(spec.tsprate, defaults.tsprate);
+   std::vector<unsigned int> fallthreshold = orDefault(spec.fallthreshold, defaults.fallthreshold);
+
+   std::vector<LearnerParams> configurations;
+   LearnerParams params;
+   if(spec.samples > 0)
+   {
+      std::mt19937_64 rng(spec.seed);
+      for(unsigned long i = 0; i < spec.samples; i++)
+      {
+         params.epsilon = draw(epsilon, rng);
+         params.alpha = draw(alpha, rng);
+         params.gamma = draw(gamma, rng);
+         params.tsprate = draw(tsprate, rng);
+         params.fallthreshold = draw(fallthreshold, rng);
+         configurations.push_back(params);
+      }
+      return configurations;
+   }
+   for(float e : epsilon)
+      for(float a : alpha)
+         for(float g : gamma)
+            for(float t : tsprate)
+               for(unsigned int f : fallthreshold)
+               {
+                  params.epsilon = e;
+                  params.alpha = a;
+                  params.gamma = g;
+                  params.tsprate = t;
+                  params.fallthreshold = f;
+                  configurations.push_back(params);
+               }
+   return configurations;
+}
+
+/*
+ * 'repeats' runs per configuration, every run with its own seed derived from 'seed'. The workers take the next run from a
+ * shared counter, so long & short runs balance out. Results are in configuration order, whatever the scheduling was.
+*/
+std::vector<SweepResult> SweepRunner::run()
+{
+   std::vector<LearnerParams> configurations = getConfigurations();
+   size_t runs = configurations.size() * std::max(1u, spec.repeats);
+   std::vector<SweepResult> results(runs);
+   unsigned int threads = spec.threads ? spec.threads : std::max(1u, std::thread::hardware_concurrency());
+   threads = std::min<size_t>(threads, std::max<size_t>(1, runs));
+   REPORT("Sweep: %zu configurations x %u runs on %u threads\n", configurations.size(), std::max(1u, spec.repeats), threads);
+
+   std::atomic<size_t> next(0);
+   std::atomic<size_t> done(0);
+   std::mutex reportlock;
+   auto worker = [&]() {
+      size_t job;
+      while((job = next.fetch_add(1)) < runs)
+      {
+         SweepResult& result = results[job];
+         result.params = configurations[job / std::max(1u, spec.repeats)];
+         result.seed = spec.seed * 0x9e3779b97f4a7c15ULL + job + 1;
+         TrainOptions options = spec.train;
+         options.persist = false;
+         options.summary = false;
+         options.reportEvery = 0.0;
+         options.seed = result.seed;
+         std::unique_ptr<QLearningSimulate> simulate(new QLearningSimulate());
+         simulate->configure(result.params);
+         simulate->train(options);
+         result.stats = simulate->getTrainStats();
+
+         std::lock_guard<std::mutex> guard(reportlock);
+         const LearnerParams& p = result.params;
+         std::string converged = result.stats.convergedAt ? "at " + std::to_string(result.stats.convergedAt) : "never";
+         REPORT("[%zu/%zu] epsilon %g alpha %g gamma %g tsprate %g fallthreshold %u: survival %.3f, converged %s (%.0f episodes/s)\n",
+                ++done, runs, p.epsilon, p.alpha, p.gamma, p.tsprate, p.fallthreshold, result.stats.windowSurvival,
+                converged.c_str(), result.stats.seconds > 0.0 ? result.stats.episodes / result.stats.seconds : 0.0);
+      }
+   };
+   std::vector<std::thread> pool;
+   for(unsigned int t = 0; t < threads; t++)
+      pool.push_back(std::thread(worker));
+   for(size_t t = 0; t < pool.size(); t++)
+      pool[t].join();
+   return results;
+}
+
+/*
+ * One line per run, 'converged_at' is empty for the runs that did not converge.
+*/
+bool SweepRunner::writeCSV(const std::string& path, const std::vector<SweepResult>& results)
+{
+   FILE* file = fopen(path.c_str(), "w");
+   if(!file)
+      return false;
+   fprintf(file, "epsilon,alpha,gamma,tsprate,fallthreshold,seed,episodes,converged_at,final_survival,final_td_error,"
+                 "survived,fell,updates,qtable_size,seconds\n");
+   for(size_t i = 0; i < results.size(); i++)
+   {
+      const SweepResult& r = results[i];
+      std::string converged = r.stats.convergedAt ? std::to_string(r.stats.convergedAt) : "";
+      fprintf(file, "%g,%g,%g,%g,%u,%llu,%lu,%s,%.6f,%.6f,%lu,%lu,%lu,%zu,%.3f\n", r.params.epsilon, r.params.alpha,
+              r.params.gamma, r.params.tsprate, r.params.fallthreshold, (unsigned long long) r.seed, r.stats.episodes,
+              converged.c_str(), r.stats.windowSurvival, r.stats.windowTDError, r.stats.survived, r.stats.fell,
+              r.stats.updates, r.stats.qtableSize, r.stats.seconds);
+   }
+   return fclose(file) == 0;
+}
@@ -0,0 +1,60 @@
+#ifndef _SWEEPRUNNER_
+#define _SWEEPRUNNER_
+
+#include "QLearningSimulate.hpp"
+
+/*
+ * What to sweep: a value list per hyperparameter (see LearnerParams, a missing list means the default). With 'samples' = 0
+ * the full grid is run, otherwise 'samples' configurations are drawn at random between the min & max of every list.
+ * Loaded from a text file with one "name value..." line per setting, '#' starts a comment, e.g.
+ *    epsilon 0.05 0.1 0.3
+ *    alpha 0.1 0.8
+ *    fallthreshold 5 50
+ *    episodes 20000
+*/
+struct SweepSpec
+{
+   std::vector<float> epsilon;
+   std::vector<float> alpha;
+   std::vector<float> gamma;
+   std::vector<float> tsprate;
+   std::vector<unsigned int> fallthreshold;
+   unsigned long samples;
+   unsigned int repeats; /* runs (seeds) per configuration */
+   unsigned int threads; /* 0 = one per core */
+   uint64_t seed;
+   TrainOptions train; /* limits & convergence window of every run, always in memory */
+
+   SweepSpec();
+
+   bool load(const std::string& path);
+};
+
+struct SweepResult
+{
+   LearnerParams params;
+   uint64_t seed;
+   TrainStats stats;
+};
+
+/*
+ * Runs every configuration of a SweepSpec as an isolated simulator + learner (own RNG, own tables, nothing persisted) on a
+ * pool of worker threads and collects convergence speed & survival rate per run.
+*/
+class SweepRunner
+{
+   SweepSpec spec;
+
+public:
+
+   SweepRunner(const SweepSpec& spec);
+
+   std::vector<LearnerParams> getConfigurations() const;
+
+   std::vector<SweepResult> run();
+
+   static bool writeCSV(const std::string& path, const std::vector<SweepResult>& results);
+
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "Trace.hpp"
+#include "log.hpp"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char TRACE_MAGIC[4] = { 'Q', 'L', 'T', 'R' };
+static const uint32_t TRACE_VERSION = 1;
+static const size_t TRACE_BUFFER = 1 << 20;
+
+TraceWriter::TraceWriter(): file(NULL), records(0) {}
+
+TraceWriter::~TraceWriter()
+{
+   close();
+}
+
+/*
+ * Truncates 'path' and writes the header.
+*/
+bool TraceWriter::open(const std::string& path)
+{
+   close();
+   file = fopen(path.c_str(), "wb");
+   if(!file)
+      return false;
+   setvbuf(file, NULL, _IOFBF, TRACE_BUFFER);
+   TraceHeader header;
+   memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+   header.version = TRACE_VERSION;
+   header.recordsize = sizeof(TraceRecord);
+   header.reserved = 0;
+   if(fwrite(&header, sizeof(header), 1, file) != 1)
+   {
+      close();
+      return false;
+   }
+   records = 0;
+   return true;
+}
+
+void TraceWriter::write(const TraceRecord& record)
+{
+   if(!file)
+      return;
+   fwrite(&record, sizeof(record), 1, file);
+   records++;
+}
+
+static TraceRecord makeRecord(double time, TraceRecordType type)
+{
+   TraceRecord record;
+   memset(&record, 0, sizeof(record));
+   record.time = time;
+   record.type = type;
+   return record;
+}
+
+void TraceWriter::recordFeet(double time, const double* sensorvalues, FeetState fstate)
+{
+   TraceRecord record = makeRecord(time, TRACE_FEET);
+   record.fstate = fstate;
+   for(int i = 0; i < 8; i++)
+      record.values[i] = (float) sensorvalues[i];
+   write(record);
+}
+
+void TraceWriter::recordImu(double time, const ImuSample& sample)
+{
+   TraceRecord record = makeRecord(time, TRACE_IMU);
+   for(int i = 0; i < 3; i++)
+   {
+      record.values[i] = (float) sample.accel[i];
+      record.values[3 + i] = (float) sample.gyro[i];
+   }
+   write(record);
+}
+
+void TraceWriter::recordPerturbation(double time)
+{
+   write(makeRecord(time, TRACE_PERTURBATION));
+}
+
+void TraceWriter::recordAction(double time, FeetState fstate, const Action& action)
+{
+   TraceRecord record = makeRecord(time, TRACE_ACTION);
+   record.fstate = fstate;
+   record.action = action.getKey();
+   write(record);
+}
+
+void TraceWriter::recordOutcome(double time, FeetState nextstate, int reward, bool fell)
+{
+   TraceRecord record = makeRecord(time, TRACE_OUTCOME);
+   record.fstate = nextstate;
+   record.reward = reward;
+   record.fell = fell ? 1 : 0;
+   write(record);
+}
+
+unsigned long TraceWriter::getRecordCount() const
+{
+   return records;
+}
+
+/*
+ * Flushes & closes the file, false if any of the writes failed.
+*/
+bool TraceWriter::close()
+{
+   if(!file)
+      return true;
+   bool ok = !ferror(file);
+   ok = (fclose(file) == 0) && ok;
+   file = NULL;
+   return ok;
+}
+
+TraceReader::TraceReader(): data(MAP_FAILED), length(0), records(NULL), count(0) {}
+
+TraceReader::~TraceReader()
+{
+   close();
+}
+
+/*
+ * A record this version of the writer could have written: a known type and, where there is one, a FeetState.
+*/
+static bool isValid(const TraceRecord& record)
+{
+   switch(record.type)
+   {
+      case TRACE_FEET:
+      case TRACE_ACTION:
+      case TRACE_OUTCOME:
+         return record.fstate < 16;
+      case TRACE_IMU:
+      case TRACE_PERTURBATION:
+         return true;
+      default:
+         return false;
+   }
+}
+
+/*
+ * Maps 'path' and checks the header and every record (a corrupt or foreign trace is rejected with the offset of the
+ * first bad record, rather than indexing the 'Q' table with a wild state later), a truncated last record is ignored.
+*/
+bool TraceReader::open(const std::string& path)
+{
+   close();
+   int fd = ::open(path.c_str(), O_RDONLY);
+   if(fd < 0)
+      return false;
+   struct stat info;
+   if(fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(TraceHeader))
+   {
+      ::close(fd);
+      return false;
+   }
+   length = info.st_size;
+   data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if(data == MAP_FAILED)
+      return false;
+
+   const TraceHeader* header = (const TraceHeader*) data;
+   if(memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_VERSION ||
+      header->recordsize != sizeof(TraceRecord))
+   {
+      ERROR("'%s' is not a (version %u) trace file.\n", path.c_str(), TRACE_VERSION);
+      close();
+      return false;
+   }
+   madvise(data, length, MADV_SEQUENTIAL);
+   records = (const TraceRecord*) ((const char*) data + sizeof(TraceHeader));
+   count = (length - sizeof(TraceHeader)) / sizeof(TraceRecord);
+   for(size_t pos = 0; pos < count; pos++)
+   {
+      if(!isValid(records[pos]))
+      {
+         ERROR("'%s': bad record at offset %zu (type %u, fstate %u).\n", path.c_str(),
+               sizeof(TraceHeader) + (pos * sizeof(TraceRecord)), records[pos].type, records[pos].fstate);
+         close();
+         errno = EINVAL;
+         return false;
+      }
+   }
+   return true;
+}
+
+size_t TraceReader::size() const
+{
+   return count;
+}
+
+const TraceRecord& TraceReader::operator[](size_t pos) const
+{
+   return records[pos];
+}
+
+void TraceReader::close()
+{
+   if(data != MAP_FAILED)
+      munmap(data, length);
+   data = MAP_FAILED;
+   length = 0;
+   records = NULL;
+   count = 0;
+}
+
+void TraceReader::getImuSample(const TraceRecord& record, ImuSample& sample)
+{
+   for(int i = 0; i < 3; i++)
+   {
+      sample.accel[i] = record.values[i];
+      sample.gyro[i] = record.values[3 + i];
+   }
+}
+
+void TraceReader::getSensorValues(const TraceRecord& record, double* sensorvalues)
+{
+   for(int i = 0; i < 8; i++)
+      sensorvalues[i] = record.values[i];
+}
+
+/*
+ * Pairs every TRACE_ACTION with the TRACE_OUTCOME following it, appends the resulting transitions (in trace order) and
+ * returns how many were found. Actions without an outcome (e.g. the trace ends mid episode) are dropped.
+*/
+size_t TraceReader::getTransitions(std::vector<Transition>& transitions) const
+{
+   size_t found = 0;
+   bool pending = false;
+   Transition transition;
+   for(size_t pos = 0; pos < count; pos++)
+   {
+      const TraceRecord& record = records[pos];
+      if(record.type == TRACE_ACTION)
+      {
+         transition.state.feet_state = (FeetState) record.fstate;
+         transition.action.setKey(record.action);
+         pending = true;
+      }
+      else if(record.type == TRACE_OUTCOME && pending)
+      {
+         transition.nextstate.feet_state = (FeetState) record.fstate;
+         transition.reward = record.reward;
+         transitions.push_back(transition);
+         pending = false;
+         found++;
+      }
+   }
+   return found;
+}
@@ -0,0 +1,105 @@
+#ifndef _TRACE_
+#define _TRACE_
+
+#include "core.hpp"
+#include <stdio.h>
+#include <vector>
+
+/*
+ * Binary sensor traces: everything the learner saw & did in an episode, in the order it happened, so that a run can be
+ * replayed offline (deterministically, at full speed, without the simulator) e.g. to reproduce perf regressions or to learn
+ * from real robot logs.
+ * File layout: a TraceHeader followed by fixed-size TraceRecords, in host byte order.
+*/
+
+enum TraceRecordType{ TRACE_FEET, TRACE_IMU, TRACE_PERTURBATION, TRACE_ACTION, TRACE_OUTCOME };
+
+struct TraceHeader
+{
+   char magic[4]; /* "QLTR" */
+   uint32_t version;
+   uint32_t recordsize; /* sizeof(TraceRecord) */
+   uint32_t reserved;
+};
+
+struct TraceRecord
+{
+   double time;
+   uint64_t action; /* TRACE_ACTION: Action::getKey() */
+   int32_t reward; /* TRACE_OUTCOME */
+   uint8_t type; /* TraceRecordType */
+   uint8_t fstate; /* TRACE_FEET & TRACE_ACTION: FeetState, TRACE_OUTCOME: FeetState after the action */
+   uint8_t fell; /* TRACE_OUTCOME */
+   uint8_t reserved;
+   float values[8]; /* TRACE_FEET: the 8 fsrs (as passed to determineState(..)), TRACE_IMU: accel x y z, gyro x y z */
+};
+
+static_assert(sizeof(TraceHeader) == 16 && sizeof(TraceRecord) == 56, "trace records are meant to be fixed-size");
+
+/*
+ * Appends records to a trace file through a large stdio buffer.
+*/
+class TraceWriter
+{
+   FILE* file;
+   unsigned long records;
+
+   void write(const TraceRecord& record);
+
+public:
+
+   TraceWriter();
+
+   ~TraceWriter();
+
+   bool open(const std::string& path);
+
+   void recordFeet(double time, const double* sensorvalues, FeetState fstate);
+
+   void recordImu(double time, const ImuSample& sample);
+
+   void recordPerturbation(double time);
+
+   void recordAction(double time, FeetState fstate, const Action& action);
+
+   void recordOutcome(double time, FeetState nextstate, int reward, bool fell);
+
+   unsigned long getRecordCount() const;
+
+   bool close();
+
+};
+
+/*
+ * Read-only view of a trace file, mmap'ed: records are used in place, nothing is copied or parsed.
+*/
+class TraceReader
+{
+   void* data;
+   size_t length;
+   const TraceRecord* records;
+   size_t count;
+
+public:
+
+   TraceReader();
+
+   ~TraceReader();
+
+   bool open(const std::string& path);
+
+   size_t size() const;
+
+   const TraceRecord& operator[](size_t pos) const;
+
+   void close();
+
+   static void getImuSample(const TraceRecord& record, ImuSample& sample);
+
+   static void getSensorValues(const TraceRecord& record, double* sensorvalues);
+
+   size_t getTransitions(std::vector<Transition>& transitions) const;
+
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 /*
  * Standing, Right foot on ground, Left foot on ground, Fallen on ground
@@ -294,6 +295,30 @@ class Action
       action += "\n";
       return action;
    }
+
+   /*
+    * Packs the 24 patterns into one base-6 number (6 exp 24 < 2 exp 63), so an action can be used as a key. Only meaningful
+    * for valid actions, see isValid().
+   */
+   uint64_t getKey() const
+   {
+      uint64_t key = 0;
+      for(int i = 23; i >= 0; i--)
+         key = (key * 6) + rs_neuron_pattern.rsneuron[i].pattern;
+      return key;
+   }
+
+   /*
+    * Inverse of getKey().
+   */
+   void setKey(uint64_t key)
+   {
+      for(int i = 0; i < 24; i++)
+      {
+         rs_neuron_pattern.rsneuron[i].pattern = (PatternType) (key % 6);
+         key /= 6;
+      }
+   }
 };
 
 class StateActionPair
@@ -313,6 +338,26 @@ public:
    double qvalue;
 };
 
+/*
+ * One observed 'state = action => nextstate' transition and its reward, see QLearner::updateBatch(..).
+*/
+struct Transition
+{
+   State state;
+   Action action;
+   State nextstate;
+   int reward;
+};
+
+/*
+ * One accelerometer (m/s^2) & gyroscope (rad/s) reading, x y z.
+*/
+struct ImuSample
+{
+   double accel[3];
+   double gyro[3];
+};
+
 /*
  * Interface for an agent.
 */
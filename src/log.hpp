@@ -3,7 +3,22 @@
 
 #include <cstdio>
 
-#define LOG(...) static_cast<void>(std::printf(__VA_ARGS__))
+/*
+ * LOG(..) can be switched off at runtime (e.g. for headless training), REPORT(..) & ERROR(..) always print.
+*/
+inline bool& logEnabled()
+{
+   static bool enabled = true;
+   return enabled;
+}
+
+inline void setLogging(bool enabled)
+{
+   logEnabled() = enabled;
+}
+
+#define LOG(...) (logEnabled() ? static_cast<void>(std::printf(__VA_ARGS__)) : static_cast<void>(0))
+#define REPORT(...) static_cast<void>(std::printf(__VA_ARGS__))
 #define ERROR(...) static_cast<void>(std::fprintf(stderr, __VA_ARGS__))
 
 #endif